@@ -0,0 +1,366 @@
+//
+//  AlpsDecoder.cpp
+//  AlpsT4USB
+//
+
+#include "AlpsDecoder.hpp"
+
+#include <string.h>
+
+/* Probes fire only when the owner handed over an enabled trace */
+#define ALPS_DECODER_TRACE(decoder, point, func, arg1, arg2, arg3, arg4) do {      \
+    if ((decoder).trace)                                                            \
+        ALPS_TRACE(*(decoder).trace, point, func, arg1, arg2, arg3, arg4);          \
+} while (0)
+
+static alps_transform compose_transform(const alps_transform &outer, const alps_transform &inner) {
+    alps_transform result;
+    
+    result.xx = outer.xx * inner.xx + outer.xy * inner.yx;
+    result.xy = outer.xx * inner.xy + outer.xy * inner.yy;
+    result.x0 = outer.xx * inner.x0 + outer.xy * inner.y0 + outer.x0;
+    result.yx = outer.yx * inner.xx + outer.yy * inner.yx;
+    result.yy = outer.yx * inner.xy + outer.yy * inner.yy;
+    result.y0 = outer.yx * inner.x0 + outer.yy * inner.y0 + outer.y0;
+    
+    return result;
+}
+
+void alps_configure_transform(alps_decoder &decoder, dev_num type, const alps_dev &geometry, UInt32 quarter_turns, bool invert_x, bool invert_y) {
+    // Built once per init, so decoding is a multiply-add per axis whatever the orientation
+    SInt32 x_min = geometry.x_min, x_max = geometry.x_max;
+    SInt32 y_min = geometry.y_min, y_max = geometry.y_max;
+    
+    decoder.type = type;
+    decoder.device_min_x = x_min;
+    decoder.device_max_x = x_max;
+    decoder.device_min_y = y_min;
+    decoder.device_max_y = y_max;
+    
+    // T4 y grows upwards, flipped within the same bounds every other stage uses
+    alps_transform native = {1, 0, 0, 0, 1, 0};
+    if (type == T4) {
+        native.yy = -1;
+        native.y0 = y_min + y_max;
+    }
+    
+    alps_transform invert = {1, 0, 0, 0, 1, 0};
+    if (invert_x) {
+        invert.xx = -1;
+        invert.x0 = x_min + x_max;
+    }
+    if (invert_y) {
+        invert.yy = -1;
+        invert.y0 = y_min + y_max;
+    }
+    
+    // Clockwise quarter turns, each keeping the result inside the swapped or original bounds
+    alps_transform rotate = {1, 0, 0, 0, 1, 0};
+    switch (quarter_turns % 4) {
+        case 1:
+            rotate = {0, -1, y_min + y_max, 1, 0, 0};
+            break;
+        case 2:
+            rotate = {-1, 0, x_min + x_max, 0, -1, y_min + y_max};
+            break;
+        case 3:
+            rotate = {0, 1, 0, -1, 0, x_min + x_max};
+            break;
+    }
+    
+    decoder.orientation = compose_transform(rotate, invert);
+    decoder.transform = compose_transform(decoder.orientation, native);
+    
+    if (quarter_turns & 1) {
+        decoder.logical_min_x = y_min;
+        decoder.logical_max_x = y_max;
+        decoder.logical_min_y = x_min;
+        decoder.logical_max_y = x_max;
+    } else {
+        decoder.logical_min_x = x_min;
+        decoder.logical_max_x = x_max;
+        decoder.logical_min_y = y_min;
+        decoder.logical_max_y = y_max;
+    }
+}
+
+void alps_configure_palm_zones(alps_decoder &decoder, UInt32 left, UInt32 right, UInt32 top, UInt32 bottom) {
+    // Top is the low-y edge. With no zone configured the whole surface is palm-prone,
+    // matching the old whole-frame drop.
+    decoder.palm_zone_everywhere = !(left || right || top || bottom);
+    
+    UInt32 width = decoder.logical_max_x - decoder.logical_min_x;
+    UInt32 height = decoder.logical_max_y - decoder.logical_min_y;
+    
+    decoder.palm_zone_left = decoder.logical_min_x + width * (left > 100 ? 100 : left) / 100;
+    decoder.palm_zone_right = decoder.logical_max_x - width * (right > 100 ? 100 : right) / 100;
+    decoder.palm_zone_top = decoder.logical_min_y + height * (top > 100 ? 100 : top) / 100;
+    decoder.palm_zone_bottom = decoder.logical_max_y - height * (bottom > 100 ? 100 : bottom) / 100;
+    
+    decoder.tracked_slots = 0;
+    decoder.suppressed_slots = 0;
+}
+
+void alps_configure_classifier(alps_decoder &decoder, UInt32 thumb_zone, uint64_t resting_dwell, UInt32 resting_travel) {
+    UInt32 height = decoder.logical_max_y - decoder.logical_min_y;
+    
+    decoder.thumb_zone_top = decoder.logical_max_y - height * (thumb_zone > 100 ? 100 : thumb_zone) / 100;
+    decoder.resting_dwell = resting_dwell;
+    decoder.resting_travel = resting_travel;
+    
+    decoder.touching_slots = 0;
+    decoder.unsettled_slots = 0;
+    decoder.resting_slots = 0;
+    decoder.thumb_slot = ALPS_T4_FRAME_NO_THUMB;
+    decoder.classified_button = 0;
+}
+
+static inline SInt32 clamp(SInt32 value, SInt32 min, SInt32 max) {
+    return value < min ? min : value > max ? max : value;
+}
+
+static bool in_palm_zone(const alps_decoder &decoder, UInt32 x, UInt32 y) {
+    return decoder.palm_zone_everywhere ||
+           x < decoder.palm_zone_left || x > decoder.palm_zone_right ||
+           y < decoder.palm_zone_top || y > decoder.palm_zone_bottom;
+}
+
+bool alps_typing_suppressed(alps_decoder &decoder, int slot, bool valid, UInt32 x, UInt32 y, AbsoluteTime timestamp) {
+    UInt8 bit = (UInt8)BIT(slot);
+    
+    if (!valid) {
+        decoder.tracked_slots &= ~bit;
+        decoder.suppressed_slots &= ~bit;
+        return false;
+    }
+    
+    bool quiet = timestamp - decoder.key_time < decoder.max_after_typing;
+    
+    // A contact let through at touchdown stays a finger. A suppressed one is checked again on
+    // every report, and becomes a finger once typing has stopped or it moves like one.
+    if (decoder.tracked_slots & bit) {
+        if (!(decoder.suppressed_slots & bit))
+            return false;
+        
+        SInt32 dx = x - decoder.suppressed_x[slot];
+        SInt32 dy = y - decoder.suppressed_y[slot];
+        
+        if (quiet && (UInt32) ((dx < 0 ? -dx : dx) + (dy < 0 ? -dy : dy)) <= PALM_RELEASE_TRAVEL)
+            return true;
+        
+        decoder.suppressed_slots &= ~bit;
+        return false;
+    }
+    
+    decoder.tracked_slots |= bit;
+    
+    if (quiet && in_palm_zone(decoder, x, y)) {
+        decoder.suppressed_slots |= bit;
+        decoder.suppressed_x[slot] = x;
+        decoder.suppressed_y[slot] = y;
+        return true;
+    }
+    
+    return false;
+}
+
+bool alps_accept_report(const alps_decoder &decoder, bool ready, bool input, UInt32 report_type, UInt32 report_id) {
+    UInt32 expected_id = decoder.type == T4 ? T4_INPUT_REPORT_ID : U1_ABSOLUTE_REPORT_ID;
+    alps_trace_drop reason;
+    
+    if (!ready)
+        reason = kAlpsDropNotReady;
+    else if (!input)
+        reason = kAlpsDropNotInput;
+    else if (report_id != expected_id)
+        reason = kAlpsDropForeignReport;
+    else
+        return true;
+    
+    ALPS_DECODER_TRACE(decoder, kAlpsTraceDrop, DBG_FUNC_NONE, reason, report_id, report_type, 0);
+    return false;
+}
+
+void alps_t4_decode(alps_decoder &decoder, const t4_input_report &reportData, AbsoluteTime timestamp, alps_frame &frame) {
+    
+    const alps_transform &transform = decoder.transform;
+    SInt32 raw_x, raw_y;
+    unsigned int x, y;
+    
+    frame.timestamp = timestamp;
+    frame.valid = 0;
+    
+    for (int i = 0; i < MAX_TOUCHES; i++) {
+        raw_x = clamp(reportData.contact[i].x_hi << 8 | reportData.contact[i].x_lo, decoder.device_min_x, decoder.device_max_x);
+        raw_y = clamp(reportData.contact[i].y_hi << 8 | reportData.contact[i].y_lo, decoder.device_min_y, decoder.device_max_y);
+        x = transform.xx * raw_x + transform.xy * raw_y + transform.x0;
+        y = transform.yx * raw_x + transform.yy * raw_y + transform.y0;
+        bool contactValid = (reportData.contact[i].palm < 0x80 &&
+             reportData.contact[i].palm > 0);
+        
+        // Ignore new touches in palm-prone zones shortly after typing
+        if (alps_typing_suppressed(decoder, i, contactValid, x, y, timestamp))
+            contactValid = false;
+        
+        frame.x[i] = x;
+        frame.y[i] = y;
+        
+        if (contactValid)
+            frame.valid |= BIT(i);
+    }
+    
+    frame.contact_count = MAX_TOUCHES;
+    frame.button = reportData.button ? ALPS_ALL_SLOTS : 0;
+}
+
+void alps_u1_decode(alps_decoder &decoder, const UInt8 *data, AbsoluteTime timestamp, alps_frame &frame) {
+    
+    const alps_transform &transform = decoder.transform;
+    SInt32 raw_x, raw_y;
+    unsigned int x, y, z;
+    
+    frame.timestamp = timestamp;
+    frame.valid = 0;
+    
+    for (int i = 0; i < MAX_TOUCHES; i++) {
+        const UInt8 *contact = &data[i * 5];
+        raw_x = clamp(alps_get_le16(contact + 3), decoder.device_min_x, decoder.device_max_x);
+        raw_y = clamp(alps_get_le16(contact + 5), decoder.device_min_y, decoder.device_max_y);
+        x = transform.xx * raw_x + transform.xy * raw_y + transform.x0;
+        y = transform.yx * raw_x + transform.yy * raw_y + transform.y0;
+        z = contact[7] & 0x7F;
+        
+        bool contactValid = z;
+        
+        // Ignore new touches in palm-prone zones shortly after typing
+        if (alps_typing_suppressed(decoder, i, contactValid, x, y, timestamp))
+            contactValid = false;
+        
+        frame.x[i] = x;
+        frame.y[i] = y;
+        
+        if (contactValid)
+            frame.valid |= BIT(i);
+    }
+    
+    frame.contact_count = __builtin_popcount(frame.valid);
+    frame.button = (data[1] & 0x1) ? frame.valid : 0;
+}
+
+void alps_classify_contacts(alps_decoder &decoder, alps_frame &frame) {
+    UInt8 landed = frame.valid & ~decoder.touching_slots;
+    UInt8 lifted = decoder.touching_slots & ~frame.valid;
+    
+    // A lift ends everything known about the contact, thumb and resting verdicts included
+    if (lifted) {
+        decoder.resting_slots &= ~lifted;
+        decoder.unsettled_slots &= ~lifted;
+        if (decoder.thumb_slot != ALPS_T4_FRAME_NO_THUMB && (lifted & BIT(decoder.thumb_slot)))
+            decoder.thumb_slot = ALPS_T4_FRAME_NO_THUMB;
+    }
+    
+    for (UInt8 pending = landed; pending; pending &= pending - 1) {
+        int i = __builtin_ctz(pending);
+        
+        decoder.contacts[i].touchdown = frame.timestamp;
+        decoder.contacts[i].x = frame.x[i];
+        decoder.contacts[i].y = frame.y[i];
+        decoder.contacts[i].entered_thumb_zone = frame.y[i] > decoder.thumb_zone_top;
+    }
+    
+    // Contacts stay unsettled until they either travel (active for good) or dwell (resting until they travel)
+    if (decoder.resting_dwell) {
+        decoder.unsettled_slots |= landed;
+        
+        for (UInt8 pending = decoder.unsettled_slots & ~landed; pending; pending &= pending - 1) {
+            int i = __builtin_ctz(pending);
+            UInt8 bit = BIT(i);
+            SInt32 dx = frame.x[i] - decoder.contacts[i].x;
+            SInt32 dy = frame.y[i] - decoder.contacts[i].y;
+            
+            if ((UInt32) ((dx < 0 ? -dx : dx) + (dy < 0 ? -dy : dy)) > decoder.resting_travel) {
+                decoder.unsettled_slots &= ~bit;
+                decoder.resting_slots &= ~bit;
+            } else if (frame.timestamp - decoder.contacts[i].touchdown >= decoder.resting_dwell) {
+                decoder.resting_slots |= bit;
+            }
+        }
+    }
+    
+    // Pick a thumb only when contacts or the button change, and keep it until it lifts. A click
+    // with nothing touching has no thumb, T4 reports the button on every slot regardless.
+    if (decoder.thumb_slot == ALPS_T4_FRAME_NO_THUMB && (landed || lifted || frame.button != decoder.classified_button) &&
+        frame.valid &&
+        (__builtin_popcount(frame.valid) >= 4 || (frame.button & BIT(0)))) {
+        // Prefer contacts that came down in the thumb zone, then the lowest one
+        UInt8 candidates = 0;
+        for (UInt8 pending = frame.valid; pending; pending &= pending - 1) {
+            int i = __builtin_ctz(pending);
+            if (decoder.contacts[i].entered_thumb_zone)
+                candidates |= BIT(i);
+        }
+        if (!candidates)
+            candidates = frame.valid;
+        
+        UInt32 y_max = 0;
+        int thumb_index = 0;
+        for (UInt8 pending = candidates; pending; pending &= pending - 1) {
+            int i = __builtin_ctz(pending);
+            if (frame.y[i] >= y_max) {
+                y_max = frame.y[i];
+                thumb_index = i;
+            }
+        }
+        
+        // A thumb doing the clicking is not resting
+        decoder.thumb_slot = thumb_index;
+        decoder.resting_slots &= ~BIT(thumb_index);
+        decoder.unsettled_slots &= ~BIT(thumb_index);
+    }
+    
+    decoder.touching_slots = frame.valid;
+    decoder.classified_button = frame.button;
+    
+    frame.thumb = decoder.thumb_slot;
+    
+    // Resting contacts are reported lifted so gesture code never sees them
+    if (decoder.resting_slots) {
+        frame.valid &= ~decoder.resting_slots;
+        
+        // T4 always reports all five slots and the button on each, U1 counts the touching
+        // ones and reports the button only on those
+        if (decoder.type == U1) {
+            frame.contact_count = __builtin_popcount(frame.valid);
+            frame.button &= frame.valid;
+        }
+    }
+    
+    ALPS_DECODER_TRACE(decoder, kAlpsTraceDecode, DBG_FUNC_NONE, frame.valid, frame.button, frame.contact_count, frame.thumb);
+}
+
+bool alps_publish_ring_frame(const alps_decoder &decoder, AlpsT4FrameRing *ring, const alps_frame &frame) {
+    UInt32 head = ring->head;
+    
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= ALPS_T4_FRAME_RING_CAPACITY) {
+        ring->dropped++;
+        ALPS_DECODER_TRACE(decoder, kAlpsTraceEmit, DBG_FUNC_NONE, frame.valid, ring->dropped, 0, 0);
+        return false;
+    }
+    
+    AlpsT4Frame* ring_frame = &ring->frames[head % ALPS_T4_FRAME_RING_CAPACITY];
+    ring_frame->timestamp = frame.timestamp;
+    ring_frame->contact_count = frame.contact_count;
+    ring_frame->valid = frame.valid;
+    ring_frame->button = frame.button != 0;
+    ring_frame->thumb = frame.thumb;
+    memcpy(ring_frame->x, frame.x, sizeof(frame.x));
+    memcpy(ring_frame->y, frame.y, sizeof(frame.y));
+    
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    ALPS_DECODER_TRACE(decoder, kAlpsTraceEmit, DBG_FUNC_NONE, frame.valid, ring->dropped, 0, 0);
+    
+    // Pairs with the consumer's fence between storing tail and re-checking head
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    
+    return __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) == head;
+}
@@ -0,0 +1,152 @@
+//
+//  AlpsDecoder.hpp
+//  AlpsT4USB
+//
+//  Report decoding, typing suppression and contact classification, as free functions over
+//  an alps_decoder that holds their state and the alps_frame they fill. Nothing here needs
+//  IOKit beyond its types, so the host harness runs the same code the driver does.
+//
+
+#ifndef AlpsDecoder_hpp
+#define AlpsDecoder_hpp
+
+#include <IOKit/IOTypes.h>
+
+#include "AlpsDevice.hpp"
+#include "AlpsT4FrameRing.h"
+#include "AlpsT4Trace.hpp"
+
+#ifndef BIT
+#define BIT(nr) (1UL << (nr))
+#endif
+
+#define T4_INPUT_REPORT_LEN         sizeof(struct t4_input_report)
+
+#define MAX_TOUCHES                 5
+#define ALPS_ALL_SLOTS              0x1F
+#define THUMB_ZONE_DEFAULT_PERCENT  20
+#define RESTING_TRAVEL_DEFAULT      40   /* logical units a resting finger may drift */
+#define PALM_RELEASE_TRAVEL         128  /* logical units a suppressed contact moves before it counts as a finger */
+
+#define U1_ABSOLUTE_REPORT_LEN      28   /* five 5-byte contacts starting at offset 3 */
+#define U1_SP_REPORT_LEN            6    /* ID, buttons, le16 dx, le16 dy */
+
+struct __attribute__((__packed__)) t4_contact_data {
+    UInt8  palm;
+    UInt8    x_lo;
+    UInt8    x_hi;
+    UInt8    y_lo;
+    UInt8    y_hi;
+};
+
+struct __attribute__((__packed__)) t4_input_report {
+    UInt8  reportID;
+    UInt8  numContacts;
+    struct t4_contact_data contact[5];
+    UInt8  button;
+    UInt8  track[5];
+    UInt8  zx[5], zy[5];
+    UInt8  palmTime[5];
+    UInt8  kilroy;
+    UInt16 timeStamp;
+};
+
+static_assert(T4_INPUT_REPORT_LEN == T4_FEATURE_REPORT_LEN, "T4 feature reports are as long as input reports");
+
+/* Integer affine map from device to reported coordinates, x' = xx * x + xy * y + x0 */
+struct alps_transform {
+    SInt32 xx, xy, x0;
+    SInt32 yx, yy, y0;
+};
+
+/* One decoded report, kept separate from the VoodooInputEvent it is emitted as */
+struct alps_frame {
+    AbsoluteTime timestamp;
+    UInt32 x[MAX_TOUCHES];
+    UInt32 y[MAX_TOUCHES];
+    UInt8  valid;           /* bit n set when contact n is touching */
+    UInt8  button;          /* bit n set when contact n reports the button down */
+    UInt8  contact_count;   /* as reported to VoodooInput */
+    UInt8  thumb;           /* contact index or ALPS_T4_FRAME_NO_THUMB */
+};
+
+/* What the classifier keeps about a contact from touchdown to lift */
+struct alps_contact {
+    AbsoluteTime touchdown;
+    UInt32 x;                   /* touchdown position */
+    UInt32 y;
+    bool entered_thumb_zone;
+};
+
+/* Everything the report path keeps between reports, set up by the alps_configure_* functions */
+struct alps_decoder {
+    dev_num type;
+    
+    /* The drop, decode and ring emit probes fire through this when it is set */
+    const AlpsTrace* trace;
+    
+    /* Device to reported coordinates, the device bounds raw coordinates are clamped to first,
+       and the reported bounds the transform maps them onto */
+    alps_transform transform;
+    alps_transform orientation;     /* the rotation and inversion in transform, without the native mapping */
+    SInt32 device_min_x;
+    SInt32 device_max_x;
+    SInt32 device_min_y;
+    SInt32 device_max_y;
+    UInt32 logical_min_x;
+    UInt32 logical_max_x;
+    UInt32 logical_min_y;
+    UInt32 logical_max_y;
+    
+    /* Typing suppression, all times in absolute-time units */
+    uint64_t max_after_typing;
+    uint64_t key_time;
+    
+    /* Slots that have been touching since before this report, and those of them rejected as palms */
+    UInt8 tracked_slots;
+    UInt8 suppressed_slots;
+    UInt32 suppressed_x[MAX_TOUCHES];   /* where each suppressed contact landed */
+    UInt32 suppressed_y[MAX_TOUCHES];
+    
+    /* Palm-prone zone edges in logical coordinates, see alps_configure_palm_zones() */
+    bool palm_zone_everywhere;
+    UInt32 palm_zone_left;
+    UInt32 palm_zone_right;
+    UInt32 palm_zone_top;
+    UInt32 palm_zone_bottom;
+    
+    /* Contact classification, see alps_classify_contacts() */
+    alps_contact contacts[MAX_TOUCHES];
+    UInt8 touching_slots;       /* valid before classification in the last frame */
+    UInt8 unsettled_slots;      /* not yet moved past resting_travel */
+    UInt8 resting_slots;
+    UInt8 thumb_slot;
+    UInt8 classified_button;
+    UInt32 thumb_zone_top;
+    UInt32 resting_travel;
+    uint64_t resting_dwell;     /* absolute-time units, 0 when resting detection is off */
+};
+
+/* Builds the transform and logical bounds from the geometry, quarter_turns rotates clockwise */
+void alps_configure_transform(alps_decoder &decoder, dev_num type, const alps_dev &geometry, UInt32 quarter_turns, bool invert_x, bool invert_y);
+
+/* Zone widths are percentages of the pad measured in from each edge, all 0 makes the whole pad palm-prone */
+void alps_configure_palm_zones(alps_decoder &decoder, UInt32 left, UInt32 right, UInt32 top, UInt32 bottom);
+
+/* thumb_zone is a percentage of the pad height, a resting_dwell of 0 turns resting detection off */
+void alps_configure_classifier(alps_decoder &decoder, UInt32 thumb_zone, uint64_t resting_dwell, UInt32 resting_travel);
+
+/* Contacts landing in a palm zone during the quiet time are dropped until it ends or they travel */
+bool alps_typing_suppressed(alps_decoder &decoder, int slot, bool valid, UInt32 x, UInt32 y, AbsoluteTime timestamp);
+
+/* Whether a report goes on to the decoder, the drop probe records why when it does not */
+bool alps_accept_report(const alps_decoder &decoder, bool ready, bool input, UInt32 report_type, UInt32 report_id);
+
+void alps_t4_decode(alps_decoder &decoder, const t4_input_report &report, AbsoluteTime timestamp, alps_frame &frame);
+void alps_u1_decode(alps_decoder &decoder, const UInt8 *data, AbsoluteTime timestamp, alps_frame &frame);
+void alps_classify_contacts(alps_decoder &decoder, alps_frame &frame);
+
+/* Puts the frame in the ring, or counts it as dropped; true when the ring was empty before */
+bool alps_publish_ring_frame(const alps_decoder &decoder, AlpsT4FrameRing *ring, const alps_frame &frame);
+
+#endif /* AlpsDecoder_hpp */
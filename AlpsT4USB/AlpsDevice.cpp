@@ -0,0 +1,329 @@
+//
+//  AlpsDevice.cpp
+//  AlpsT4USB
+//
+
+#include "AlpsDevice.hpp"
+
+/* Register transactions trace only when the owner handed over an enabled trace */
+#define ALPS_DEVICE_TRACE(func, arg1, arg2, arg3, arg4) do {                        \
+    if (trace)                                                                      \
+        ALPS_TRACE(*trace, kAlpsTraceRegister, func, arg1, arg2, arg3, arg4);       \
+} while (0)
+
+AlpsDevice::AlpsDevice() : type(T4), product_id(0), absolute_report_id(T4_INPUT_REPORT_ID), has_stick(false),
+    pri_data(), t4_sys_config(0), u1_dev_ctrl(U1_TP_ABS_MODE), transport(NULL), trace(NULL) {
+}
+
+bool AlpsDevice::identify(UInt32 vendor_id, UInt32 product_id) {
+    if (vendor_id != ALPS_VENDOR)
+        return false;
+    
+    switch (product_id) {
+        case HID_PRODUCT_ID_T4_USB:
+        case HID_PRODUCT_ID_G1:
+        case HID_PRODUCT_ID_T4_BTNLESS:
+            type = T4;
+            absolute_report_id = T4_INPUT_REPORT_ID;
+            break;
+        case HID_PRODUCT_ID_U1:
+        case HID_PRODUCT_ID_U1_DUAL:
+            type = U1;
+            absolute_report_id = U1_ABSOLUTE_REPORT_ID;
+            break;
+        default:
+            return false;
+    }
+    
+    this->product_id = product_id;
+    return true;
+}
+
+void AlpsDevice::set_transport(AlpsHIDTransport* transport) {
+    this->transport = transport;
+}
+
+void AlpsDevice::set_trace(const AlpsTrace* trace) {
+    this->trace = trace;
+}
+
+IOReturn AlpsDevice::device_init(const char** step) {
+    const char* failed = NULL;
+    IOReturn ret = kIOReturnNotReady;
+    
+    if (transport) {
+        switch (type) {
+            case T4:
+                ret = t4_device_init(&failed);
+                break;
+            case U1:
+                ret = u1_device_init(&failed);
+                break;
+        }
+    } else {
+        failed = "reach the device";
+    }
+    
+    if (step)
+        *step = failed;
+    
+    return ret;
+}
+
+IOReturn AlpsDevice::t4_device_init(const char** step) {
+    
+    UInt8 tmp = '\0', sen_line_num_x, sen_line_num_y;
+    IOReturn ret = kIOReturnSuccess;
+    
+    if (product_id == HID_PRODUCT_ID_T4_BTNLESS) {
+        ret = t4_transfer_register(t4_read_frame<T4_PRM_ID_CONFIG_3>::value, &tmp);
+        if (ret != kIOReturnSuccess) {
+            *step = "read T4_PRM_ID_CONFIG_3";
+            return ret;
+        }
+        sen_line_num_x = 16 + ((tmp & 0x0F) | (tmp & 0x08 ? 0xF0 : 0));
+        sen_line_num_y = 12 + (((tmp & 0xF0) >> 4) | (tmp & 0x80 ? 0xF0 : 0));
+        ret = t4_transfer_register(t4_read_frame<PRM_SYS_CONFIG_1>::value, &tmp);
+        if (ret != kIOReturnSuccess) {
+            *step = "read PRM_SYS_CONFIG_1";
+            return ret;
+        }
+    } else {
+        sen_line_num_x = T4_DEFAULT_SEN_LINE_NUM_X;
+        sen_line_num_y = T4_DEFAULT_SEN_LINE_NUM_Y;
+    }
+    
+    pri_data.x_max = sen_line_num_x * T4_COUNT_PER_ELECTRODE;
+    pri_data.x_min = T4_COUNT_PER_ELECTRODE;
+    pri_data.y_max = sen_line_num_y * T4_COUNT_PER_ELECTRODE;
+    pri_data.y_min = T4_COUNT_PER_ELECTRODE;
+    pri_data.x_active_len_mm = pri_data.y_active_len_mm = 0;
+    pri_data.btn_cnt = 1;
+    
+    tmp |= 0x02;
+    
+    ret = t4_read_write_register(PRM_SYS_CONFIG_1, NULL, tmp, false);
+    if (ret != kIOReturnSuccess) {
+        *step = "write PRM_SYS_CONFIG_1";
+        return ret;
+    }
+    t4_sys_config = tmp;
+    
+    ret = t4_transfer_register(t4_write_frame<T4_PRM_FEED_CONFIG_1, T4_I2C_ABS>::value, NULL);
+    if (ret != kIOReturnSuccess) {
+        *step = "write T4_PRM_FEED_CONFIG_1";
+        return ret;
+    }
+    
+    ret = t4_transfer_register(t4_write_frame<T4_PRM_FEED_CONFIG_4, T4_FEEDCFG4_ADVANCED_ABS_ENABLE>::value, NULL);
+    if (ret != kIOReturnSuccess) {
+        *step = "write T4_PRM_FEED_CONFIG_4";
+        return ret;
+    }
+    pri_data.max_fingers = 5;
+    
+    return kIOReturnSuccess;
+}
+
+IOReturn AlpsDevice::u1_device_init(const char** step) {
+    
+    UInt8 tmp, dev_ctrl, sen_line_num_x, sen_line_num_y;
+    UInt8 pitch_x, pitch_y, resolution;
+    IOReturn ret = kIOReturnSuccess;
+    
+    /* Device initialization */
+    ret = u1_transfer_register(u1_read_frame<ADDRESS_U1_DEV_CTRL_1>::value, &dev_ctrl);
+    if (ret != kIOReturnSuccess) {
+        *step = "read device mode";
+        return ret;
+    }
+    
+    dev_ctrl &= ~U1_DISABLE_DEV;
+    dev_ctrl |= U1_TP_ABS_MODE;
+    
+    /* Put the pointing stick of dual devices into absolute mode in the same write */
+    ret = u1_transfer_register(u1_read_frame<ADDRESS_U1_DEVICE_TYP>::value, &tmp);
+    if (ret != kIOReturnSuccess) {
+        *step = "read device type";
+        return ret;
+    }
+    
+    has_stick = tmp & U1_DEVTYPE_SP_SUPPORT;
+    if (has_stick)
+        dev_ctrl |= U1_SP_ABS_MODE;
+    
+    ret = u1_read_write_register(ADDRESS_U1_DEV_CTRL_1, NULL, dev_ctrl, false);
+    if (ret != kIOReturnSuccess) {
+        *step = "put device in absolute mode";
+        return ret;
+    }
+    u1_dev_ctrl = dev_ctrl;
+    
+    ret = u1_transfer_register(u1_read_frame<ADDRESS_U1_NUM_SENS_X>::value, &sen_line_num_x);
+    if (ret != kIOReturnSuccess) {
+        *step = "read sen_line_num_x";
+        return ret;
+    }
+    
+    ret = u1_transfer_register(u1_read_frame<ADDRESS_U1_NUM_SENS_Y>::value, &sen_line_num_y);
+    if (ret != kIOReturnSuccess) {
+        *step = "read sen_line_num_y";
+        return ret;
+    }
+    
+    ret = u1_transfer_register(u1_read_frame<ADDRESS_U1_PITCH_SENS_X>::value, &pitch_x);
+    if (ret != kIOReturnSuccess) {
+        *step = "read pitch_sens_x";
+        return ret;
+    }
+    
+    ret = u1_transfer_register(u1_read_frame<ADDRESS_U1_PITCH_SENS_Y>::value, &pitch_y);
+    if (ret != kIOReturnSuccess) {
+        *step = "read pitch_sens_y";
+        return ret;
+    }
+    
+    ret = u1_transfer_register(u1_read_frame<ADDRESS_U1_RESO_DWN_ABS>::value, &resolution);
+    if (ret != kIOReturnSuccess) {
+        *step = "read absolute mode resolution";
+        return ret;
+    }
+    
+    pri_data.x_active_len_mm = (pitch_x * (sen_line_num_x - 1)) / 10;
+    pri_data.y_active_len_mm = (pitch_y * (sen_line_num_y - 1)) / 10;
+    
+    pri_data.x_max = (resolution << 2) * (sen_line_num_x - 1);
+    pri_data.x_min = 1;
+    pri_data.y_max = (resolution << 2) * (sen_line_num_y - 1);
+    pri_data.y_min = 1;
+    
+    ret = u1_transfer_register(u1_read_frame<ADDRESS_U1_PAD_BTN>::value, &tmp);
+    if (ret != kIOReturnSuccess) {
+        *step = "read button count";
+        return ret;
+    }
+    
+    if ((tmp & 0x0F) == (tmp & 0xF0) >> 4) {
+        pri_data.btn_cnt = (tmp & 0x0F);
+    } else {
+        /* Button pad */
+        pri_data.btn_cnt = 1;
+    }
+    
+    return kIOReturnSuccess;
+}
+
+void AlpsDevice::set_default_geometry() {
+    pri_data.x_min = T4_COUNT_PER_ELECTRODE;
+    pri_data.x_max = T4_DEFAULT_SEN_LINE_NUM_X * T4_COUNT_PER_ELECTRODE;
+    pri_data.y_min = T4_COUNT_PER_ELECTRODE;
+    pri_data.y_max = T4_DEFAULT_SEN_LINE_NUM_Y * T4_COUNT_PER_ELECTRODE;
+    pri_data.x_active_len_mm = pri_data.y_active_len_mm = 0;
+}
+
+UInt32 AlpsDevice::physical_max_x() const {
+    // The T4 does not report its size, U1 sizes are in mm and VoodooInput wants 0.01 mm
+    return type == U1 ? pri_data.x_active_len_mm * 10 : T4_PHYSICAL_MAX_X;
+}
+
+UInt32 AlpsDevice::physical_max_y() const {
+    return type == U1 ? pri_data.y_active_len_mm * 10 : T4_PHYSICAL_MAX_Y;
+}
+
+bool AlpsDevice::in_absolute_mode() {
+    UInt8 val = 0;
+    
+    switch (type) {
+        case T4:
+            if (t4_transfer_register(t4_read_frame<T4_PRM_FEED_CONFIG_1>::value, &val) != kIOReturnSuccess)
+                return true;
+            return val == T4_I2C_ABS;
+        case U1:
+            if (u1_transfer_register(u1_read_frame<ADDRESS_U1_DEV_CTRL_1>::value, &val) != kIOReturnSuccess)
+                return true;
+            return val & U1_TP_ABS_MODE;
+    }
+    
+    return true;
+}
+
+IOReturn AlpsDevice::restore_absolute_mode() {
+    IOReturn ret = kIOReturnSuccess;
+    
+    switch (type) {
+        case T4:
+            ret = t4_read_write_register(PRM_SYS_CONFIG_1, NULL, t4_sys_config, false);
+            if (ret == kIOReturnSuccess)
+                ret = t4_transfer_register(t4_write_frame<T4_PRM_FEED_CONFIG_1, T4_I2C_ABS>::value, NULL);
+            if (ret == kIOReturnSuccess)
+                ret = t4_transfer_register(t4_write_frame<T4_PRM_FEED_CONFIG_4, T4_FEEDCFG4_ADVANCED_ABS_ENABLE>::value, NULL);
+            break;
+        case U1:
+            ret = u1_read_write_register(ADDRESS_U1_DEV_CTRL_1, NULL, u1_dev_ctrl, false);
+            break;
+    }
+    
+    return ret;
+}
+
+IOReturn AlpsDevice::u1_read_write_register(UInt32 address, UInt8 *read_val, UInt8 write_val, bool read_flag) {
+    
+    if (read_flag)
+        return u1_transfer_register(u1_encode_read(address), read_val);
+    
+    return u1_transfer_register(u1_encode_write(address, write_val), NULL);
+}
+
+IOReturn AlpsDevice::u1_transfer_register(const u1_register_frame &request, UInt8 *read_val) {
+    
+    UInt32 address = alps_get_le32(request.bytes + 2);
+    
+    ALPS_DEVICE_TRACE(DBG_FUNC_START, address, request.bytes[1], 0, 0);
+    
+    IOReturn ret = transport->setFeatureReport(request.bytes, U1_FEATURE_REPORT_LEN);
+    if (ret == kIOReturnSuccess && read_val) {
+        u1_register_frame reply = request;
+    
+        ret = transport->getFeatureReport(reply.bytes, U1_FEATURE_REPORT_LEN);
+        if (ret == kIOReturnSuccess)
+            u1_decode_read_reply(reply, *read_val);
+    }
+    
+    ALPS_DEVICE_TRACE(DBG_FUNC_END, address, ret, read_val ? *read_val : 0, kAlpsRegisterOK);
+    
+    return ret;
+}
+
+IOReturn AlpsDevice::t4_read_write_register(UInt32 address, UInt8 *read_val, UInt8 write_val, bool read_flag) {
+    
+    if (read_flag)
+        return t4_transfer_register(t4_encode_read(address), read_val);
+    
+    return t4_transfer_register(t4_encode_write(address, write_val), NULL);
+}
+
+IOReturn AlpsDevice::t4_transfer_register(const t4_register_frame &request, UInt8 *read_val) {
+    
+    UInt32 address = t4_frame_address(request);
+    alps_register_status status = kAlpsRegisterOK;
+    
+    ALPS_DEVICE_TRACE(DBG_FUNC_START, address, request.bytes[1], 0, 0);
+    
+    IOReturn ret = transport->setFeatureReport(request.bytes, T4_FEATURE_REPORT_LEN);
+    if (ret == kIOReturnSuccess && read_val) {
+        // The reply lands in a copy of the request, as it did when one descriptor was reused
+        t4_register_frame reply = request;
+    
+        ret = transport->getFeatureReport(reply.bytes, T4_FEATURE_REPORT_LEN);
+        if (ret == kIOReturnSuccess) {
+            // Bad replies are reported by the caller, the trace record says what was wrong
+            status = t4_decode_read_reply(reply, address, *read_val);
+            if (status != kAlpsRegisterOK)
+                ret = kIOReturnIOError;
+        }
+    }
+    
+    ALPS_DEVICE_TRACE(DBG_FUNC_END, address, ret, read_val ? *read_val : 0, status);
+    
+    return ret;
+}
@@ -0,0 +1,133 @@
+//
+//  AlpsDevice.hpp
+//  AlpsT4USB
+//
+//  Identification, register access and init sequences for T4 and U1 devices. Everything
+//  here reaches the device through an AlpsHIDTransport and nothing else, so the same code
+//  runs in the kext and against hidraw in the host build. Logging and publishing the
+//  geometry are left to the caller.
+//
+
+#ifndef AlpsDevice_hpp
+#define AlpsDevice_hpp
+
+#include <IOKit/IOTypes.h>
+
+#include "AlpsHIDTransport.hpp"
+#include "AlpsRegisterCodec.hpp"
+#include "AlpsT4Trace.hpp"
+
+
+#define HID_PRODUCT_ID_U1_DUAL      0x120B
+#define HID_PRODUCT_ID_T4_BTNLESS   0x120C
+#define HID_PRODUCT_ID_G1           0x120D
+#define HID_PRODUCT_ID_U1           0x1209
+#define HID_PRODUCT_ID_T4_USB       0X1216
+#define ALPS_VENDOR                 0x44e
+
+
+#define T4_INPUT_REPORT_ID          0x09
+
+#define T4_ADDRESS_BASE                0xC2C0
+#define PRM_SYS_CONFIG_1            (T4_ADDRESS_BASE + 0x0002)
+#define T4_PRM_FEED_CONFIG_1        (T4_ADDRESS_BASE + 0x0004)
+#define T4_PRM_FEED_CONFIG_4        (T4_ADDRESS_BASE + 0x001A)
+#define T4_PRM_ID_CONFIG_3          (T4_ADDRESS_BASE + 0x00B0)
+
+#define T4_FEEDCFG4_ADVANCED_ABS_ENABLE            0x01
+#define T4_I2C_ABS                  0x78
+
+#define T4_COUNT_PER_ELECTRODE      256
+#define T4_DEFAULT_SEN_LINE_NUM_X   20
+#define T4_DEFAULT_SEN_LINE_NUM_Y   12
+#define T4_PHYSICAL_MAX_X           10240
+#define T4_PHYSICAL_MAX_Y           6140
+
+#define U1_ABSOLUTE_REPORT_ID       0x03 /* Absolute data ReportID */
+#define U1_SP_ABSOLUTE_REPORT_ID    0x06 /* Pointing stick ReportID */
+
+
+#define U1_DISABLE_DEV              0x01
+#define U1_TP_ABS_MODE              0x02
+#define U1_SP_ABS_MODE              0x80
+#define U1_DEVTYPE_SP_SUPPORT       0x10
+
+#define ADDRESS_U1_DEV_CTRL_1       0x00800040
+#define ADDRESS_U1_DEVICE_TYP       0x00800043
+#define ADDRESS_U1_NUM_SENS_X       0x00800047
+#define ADDRESS_U1_NUM_SENS_Y       0x00800048
+#define ADDRESS_U1_PITCH_SENS_X     0x00800049
+#define ADDRESS_U1_PITCH_SENS_Y     0x0080004A
+#define ADDRESS_U1_RESO_DWN_ABS     0x0080004E
+#define ADDRESS_U1_PAD_BTN          0x00800052
+
+enum dev_num {
+    U1,
+    T4,
+};
+
+struct alps_dev {
+    UInt8     max_fingers;
+    UInt32    x_active_len_mm;
+    UInt32    y_active_len_mm;
+    UInt32    x_max;
+    UInt32    y_max;
+    UInt32    x_min;
+    UInt32    y_min;
+    UInt32    btn_cnt;
+};
+
+class AlpsDevice {
+public:
+    AlpsDevice();
+    
+    /* Sets type and absolute_report_id, false for anything this driver does not handle */
+    bool identify(UInt32 vendor_id, UInt32 product_id);
+    
+    void set_transport(AlpsHIDTransport* transport);
+    
+    /* Register transactions are traced through this when it is set */
+    void set_trace(const AlpsTrace* trace);
+    
+    /* Puts the device in absolute mode and reads its geometry into pri_data, on failure
+       step (if non-NULL) is pointed at a description of what could not be done */
+    IOReturn device_init(const char** step);
+    
+    /* Unqueried T4 geometry, good enough for matching until the real values are read */
+    void set_default_geometry();
+    
+    UInt32 physical_max_x() const;
+    UInt32 physical_max_y() const;
+    
+    /* Reads the mode register, a failed read counts as absolute so nothing gets rewritten */
+    bool in_absolute_mode();
+    
+    /* Rewrites only the mode registers, the geometry read at init is still valid */
+    IOReturn restore_absolute_mode();
+    
+    IOReturn u1_read_write_register(UInt32 address, UInt8 *read_val, UInt8 write_val, bool read_flag);
+    IOReturn t4_read_write_register(UInt32 address, UInt8 *read_val, UInt8 write_val, bool read_flag);
+    
+    /* read_val is only filled, and the reply only fetched, when it is non-NULL */
+    IOReturn u1_transfer_register(const u1_register_frame &request, UInt8 *read_val);
+    IOReturn t4_transfer_register(const t4_register_frame &request, UInt8 *read_val);
+    
+    dev_num type;
+    UInt32 product_id;
+    UInt32 absolute_report_id;
+    bool has_stick;
+    alps_dev pri_data;
+    
+    /* Mode register values written by the last successful init */
+    UInt8 t4_sys_config;
+    UInt8 u1_dev_ctrl;
+    
+private:
+    IOReturn t4_device_init(const char** step);
+    IOReturn u1_device_init(const char** step);
+    
+    AlpsHIDTransport* transport;
+    const AlpsTrace* trace;
+};
+
+#endif /* AlpsDevice_hpp */
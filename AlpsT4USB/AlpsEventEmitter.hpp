@@ -0,0 +1,97 @@
+//
+//  AlpsEventEmitter.hpp
+//  AlpsT4USB
+//
+//  Turns alps_frames into multitouch events, writing only the transducer fields that
+//  changed since the last frame. Templated on the event so the host harness can run it
+//  on a mirror of VoodooInputEvent; alps_event_traits supplies the enum values.
+//
+
+#ifndef AlpsEventEmitter_hpp
+#define AlpsEventEmitter_hpp
+
+#include <string.h>
+
+#include "AlpsDecoder.hpp"
+
+/*
+ * Specialized next to each event type, providing
+ *   static ... finger(int slot);   finger type of a slot that is not the thumb
+ *   static ... thumb();            finger type of the thumb
+ *   static ... transducer();       transducer type of every slot
+ */
+template <typename Event>
+struct alps_event_traits;
+
+/* What an event currently holds, so only changed transducer fields get written */
+struct alps_emitted {
+    UInt8 valid;
+    UInt8 button;
+    UInt8 thumb;
+};
+
+template <typename Event>
+void alps_reset_event(Event &event, alps_emitted &emitted) {
+    typedef alps_event_traits<Event> traits;
+    
+    // Fields that never change are written once here, alps_update_event only touches the rest
+    memset(&event, 0, sizeof(Event));
+    
+    for (int i = 0; i < MAX_TOUCHES; i++) {
+        event.transducers[i].type = traits::transducer();
+        event.transducers[i].fingerType = traits::finger(i);
+        event.transducers[i].secondaryId = i;
+        event.transducers[i].supportsPressure = false;
+    }
+    
+    emitted.valid = 0;
+    emitted.button = 0;
+    emitted.thumb = ALPS_T4_FRAME_NO_THUMB;
+}
+
+template <typename Event>
+void alps_update_event(Event &event, alps_emitted &emitted, const alps_frame &frame) {
+    typedef alps_event_traits<Event> traits;
+    
+    UInt8 valid_changed = frame.valid ^ emitted.valid;
+    UInt8 button_changed = frame.button ^ emitted.button;
+    
+    for (int i = 0; i < MAX_TOUCHES; i++) {
+        auto &transducer = event.transducers[i];
+        UInt8 bit = BIT(i);
+        
+        transducer.timestamp = frame.timestamp;
+        
+        if (frame.valid & bit) {
+            transducer.previousCoordinates = transducer.currentCoordinates;
+            transducer.currentCoordinates.x = frame.x[i];
+            transducer.currentCoordinates.y = frame.y[i];
+        } else if (valid_changed & bit) {
+            transducer.currentCoordinates = transducer.previousCoordinates;
+        }
+        
+        if (valid_changed & bit) {
+            transducer.isValid = frame.valid & bit;
+            transducer.isTransducerActive = frame.valid & bit;
+        }
+        
+        if (button_changed & bit)
+            transducer.isPhysicalButtonDown = frame.button & bit;
+    }
+    
+    if (frame.thumb != emitted.thumb) {
+        if (emitted.thumb != ALPS_T4_FRAME_NO_THUMB)
+            event.transducers[emitted.thumb].fingerType = traits::finger(emitted.thumb);
+        if (frame.thumb != ALPS_T4_FRAME_NO_THUMB)
+            event.transducers[frame.thumb].fingerType = traits::thumb();
+    }
+    
+    emitted.valid = frame.valid;
+    emitted.button = frame.button;
+    emitted.thumb = frame.thumb;
+    
+    event.contact_count = frame.contact_count;
+    event.timestamp = frame.timestamp;
+}
+
+#endif /* AlpsEventEmitter_hpp */
@@ -0,0 +1,125 @@
+//
+//  AlpsFlightRecorder.cpp
+//  AlpsT4USB
+//
+
+#include "AlpsFlightRecorder.hpp"
+
+bool AlpsFlightRecorder::configure(UInt64 threshold_us) {
+    free();
+    
+    if (!threshold_us)
+        return true;
+    
+    // IOMalloc memory is wired, nothing on the report path can fault
+    history = (AlpsFlightRecord*) IOMalloc(sizeof(AlpsFlightRecord) * ALPS_FLIGHT_RECORDER_HISTORY);
+    capture = (AlpsFlightCapture*) IOMalloc(sizeof(AlpsFlightCapture));
+    
+    if (!history || !capture) {
+        free();
+        return false;
+    }
+    
+    bzero(history, sizeof(AlpsFlightRecord) * ALPS_FLIGHT_RECORDER_HISTORY);
+    bzero(capture, sizeof(AlpsFlightCapture));
+    
+    nanoseconds_to_absolutetime(threshold_us * 1000, &threshold);
+    
+    head = 0;
+    outliers = 0;
+    capture_state = kCaptureIdle;
+    
+    return true;
+}
+
+void AlpsFlightRecorder::free() {
+    if (history)
+        IOFree(history, sizeof(AlpsFlightRecord) * ALPS_FLIGHT_RECORDER_HISTORY);
+    if (capture)
+        IOFree(capture, sizeof(AlpsFlightCapture));
+    
+    history = NULL;
+    capture = NULL;
+    current = NULL;
+}
+
+void AlpsFlightRecorder::begin(AbsoluteTime report_time, IOMemoryDescriptor *report, IOHIDReportType report_type, UInt32 report_id) {
+    AlpsFlightRecord* record = &history[head % ALPS_FLIGHT_RECORDER_HISTORY];
+    
+    clock_get_uptime(&record->entry);
+    
+    record->report_time = report_time;
+    record->decoded = 0;
+    record->emitted = 0;
+    record->exit = 0;
+    record->report_id = report_id;
+    record->report_type = report_type;
+    record->length = 0;
+    
+    if (report) {
+        IOByteCount length = report->getLength();
+        
+        record->length = length > 0xFFFF ? 0xFFFF : (UInt16) length;
+        report->readBytes(0, record->bytes, length < ALPS_FLIGHT_RECORDER_REPORT_BYTES ? length : ALPS_FLIGHT_RECORDER_REPORT_BYTES);
+    }
+    
+    current = record;
+}
+
+void AlpsFlightRecorder::end() {
+    AlpsFlightRecord* record = current;
+    
+    if (!record)
+        return;
+    
+    current = NULL;
+    head++;
+    
+    clock_get_uptime(&record->exit);
+    
+    // copyCapture() only touches the capture once it is complete, and only this path
+    // moves it out of idle, so no lock is needed for the copies below
+    UInt32 state = __atomic_load_n(&capture_state, __ATOMIC_ACQUIRE);
+    
+    if (state == kCaptureRecording) {
+        capture->records[capture->count++] = *record;
+        
+        if (!--post_remaining)
+            __atomic_store_n(&capture_state, kCaptureComplete, __ATOMIC_RELEASE);
+        return;
+    }
+    
+    if (record->exit - record->entry <= threshold)
+        return;
+    
+    outliers++;
+    
+    // Keep the first capture until someone collects it
+    if (state != kCaptureIdle)
+        return;
+    
+    UInt32 count = head < ALPS_FLIGHT_RECORDER_HISTORY ? head : ALPS_FLIGHT_RECORDER_HISTORY;
+    
+    capture->version = ALPS_FLIGHT_RECORDER_VERSION;
+    capture->threshold = threshold;
+    capture->outliers = outliers;
+    capture->count = count;
+    capture->trigger = count - 1;
+    
+    for (UInt32 i = 0; i < count; i++)
+        capture->records[i] = history[(head - count + i) % ALPS_FLIGHT_RECORDER_HISTORY];
+    
+    post_remaining = ALPS_FLIGHT_RECORDER_POST_TRIGGER;
+    __atomic_store_n(&capture_state, kCaptureRecording, __ATOMIC_RELEASE);
+}
+
+OSData* AlpsFlightRecorder::copyCapture() {
+    if (!capture || __atomic_load_n(&capture_state, __ATOMIC_ACQUIRE) != kCaptureComplete)
+        return NULL;
+    
+    OSData* data = OSData::withBytes(capture, (unsigned) (sizeof(AlpsFlightCapture) - sizeof(capture->records) + capture->count * sizeof(AlpsFlightRecord)));
+    
+    __atomic_store_n(&capture_state, kCaptureIdle, __ATOMIC_RELEASE);
+    
+    return data;
+}
@@ -0,0 +1,94 @@
+//
+//  AlpsFlightRecorder.hpp
+//  AlpsT4USB
+//
+//  Catches slow reports in the field. Every report gets its bytes and stage times written
+//  to a short history; when one takes longer than the threshold from handleInterruptReport
+//  entry to being delivered, the history and the next few reports are kept for retrieval.
+//
+
+#ifndef AlpsFlightRecorder_hpp
+#define AlpsFlightRecorder_hpp
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOMemoryDescriptor.h>
+#include <IOKit/hid/IOHIDInterface.h>
+#include <kern/clock.h>
+
+/* Threshold in microseconds, 0 leaves the recorder off and unallocated */
+#define ALPS_FLIGHT_RECORDER_THRESHOLD_KEY  "FlightRecorderThreshold"
+/* Set to true through setProperties to publish the capture as ALPS_FLIGHT_RECORDER_CAPTURE_KEY */
+#define ALPS_FLIGHT_RECORDER_DUMP_KEY       "FlightRecorderDump"
+#define ALPS_FLIGHT_RECORDER_CAPTURE_KEY    "FlightRecorderCapture"
+
+#define ALPS_FLIGHT_RECORDER_VERSION        1
+#define ALPS_FLIGHT_RECORDER_HISTORY        16      /* reports up to and including the slow one, power of two */
+#define ALPS_FLIGHT_RECORDER_POST_TRIGGER   4       /* reports kept after it */
+#define ALPS_FLIGHT_RECORDER_REPORT_BYTES   64
+
+/* Stage times are absolute time, a stage the report never reached stays 0 */
+struct AlpsFlightRecord {
+    UInt64  report_time;        /* timestamp handed to handleInterruptReport */
+    UInt64  entry;
+    UInt64  decoded;
+    UInt64  emitted;            /* messageClient returned or the frame went into the ring */
+    UInt64  exit;
+    UInt32  report_id;
+    UInt16  length;             /* of the report, only the first ALPS_FLIGHT_RECORDER_REPORT_BYTES are kept */
+    UInt8   report_type;
+    UInt8   reserved;
+    UInt8   bytes[ALPS_FLIGHT_RECORDER_REPORT_BYTES];
+};
+
+struct AlpsFlightCapture {
+    UInt32  version;
+    UInt32  count;              /* records in use */
+    UInt32  trigger;            /* index of the slow report */
+    UInt32  outliers;           /* slow reports seen since start, captured or not */
+    UInt64  threshold;          /* absolute time */
+    struct AlpsFlightRecord records[ALPS_FLIGHT_RECORDER_HISTORY + ALPS_FLIGHT_RECORDER_POST_TRIGGER];
+};
+
+class AlpsFlightRecorder {
+public:
+    /* threshold_us of 0 frees the buffers and turns recording off */
+    bool configure(UInt64 threshold_us);
+    void free();
+    
+    bool isEnabled() const { return history != NULL; }
+    
+    /* Only called from the report path, begin() and end() bracket one report */
+    void begin(AbsoluteTime report_time, IOMemoryDescriptor *report, IOHIDReportType report_type, UInt32 report_id);
+    void end();
+    
+    void stampDecoded() {
+        if (__builtin_expect(current != NULL, 0))
+            clock_get_uptime(&current->decoded);
+    }
+    
+    void stampEmitted() {
+        if (__builtin_expect(current != NULL, 0))
+            clock_get_uptime(&current->emitted);
+    }
+    
+    /* The finished capture as OSData, NULL while there is none, and start looking for the next one */
+    OSData* copyCapture();
+    
+private:
+    enum {
+        kCaptureIdle,
+        kCaptureRecording,
+        kCaptureComplete
+    };
+    
+    AlpsFlightRecord* history;
+    AlpsFlightCapture* capture;
+    AlpsFlightRecord* current;
+    UInt32 head;
+    UInt32 post_remaining;
+    UInt32 capture_state;
+    UInt32 outliers;
+    UInt64 threshold;
+};
+
+#endif /* AlpsFlightRecorder_hpp */
@@ -0,0 +1,26 @@
+//
+//  AlpsHIDTransport.hpp
+//  AlpsT4USB
+//
+//  The HID operations the register and init code needs, kept apart from IOHIDInterface
+//  so that code does not care how feature reports reach the device. AlpsIOHIDTransport
+//  is the kext's backend, the host build adds one over Linux hidraw.
+//
+
+#ifndef AlpsHIDTransport_hpp
+#define AlpsHIDTransport_hpp
+
+#include <IOKit/IOTypes.h>
+
+class AlpsHIDTransport {
+public:
+    virtual ~AlpsHIDTransport() {}
+    
+    /* report[0] is the report ID, length includes it */
+    virtual IOReturn setFeatureReport(const UInt8 *report, UInt32 length) = 0;
+    
+    /* report[0] holds the report ID on entry, the whole buffer is overwritten with the reply */
+    virtual IOReturn getFeatureReport(UInt8 *report, UInt32 length) = 0;
+};
+
+#endif /* AlpsHIDTransport_hpp */
@@ -0,0 +1,37 @@
+//
+//  AlpsIOHIDTransport.cpp
+//  AlpsT4USB
+//
+
+#include "AlpsIOHIDTransport.hpp"
+
+IOReturn AlpsIOHIDTransport::setFeatureReport(const UInt8 *report, UInt32 length) {
+    if (!hid_interface)
+        return kIOReturnNotReady;
+    
+    IOBufferMemoryDescriptor* buffer = IOBufferMemoryDescriptor::withBytes(report, length, kIODirectionInOut);
+    if (!buffer)
+        return kIOReturnNoMemory;
+    
+    IOReturn ret = hid_interface->setReport(buffer, kIOHIDReportTypeFeature, report[0]);
+    
+    buffer->release();
+    return ret;
+}
+
+IOReturn AlpsIOHIDTransport::getFeatureReport(UInt8 *report, UInt32 length) {
+    if (!hid_interface)
+        return kIOReturnNotReady;
+    
+    // Seeded with the caller's bytes so a short reply leaves the rest as it was
+    IOBufferMemoryDescriptor* buffer = IOBufferMemoryDescriptor::withBytes(report, length, kIODirectionInOut);
+    if (!buffer)
+        return kIOReturnNoMemory;
+    
+    IOReturn ret = hid_interface->getReport(buffer, kIOHIDReportTypeFeature, report[0]);
+    
+    buffer->readBytes(0, report, length);
+    
+    buffer->release();
+    return ret;
+}
@@ -0,0 +1,30 @@
+//
+//  AlpsIOHIDTransport.hpp
+//  AlpsT4USB
+//
+//  AlpsHIDTransport over the IOHIDInterface the driver matched on.
+//
+
+#ifndef AlpsIOHIDTransport_hpp
+#define AlpsIOHIDTransport_hpp
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
+#include <IOKit/hid/IOHIDInterface.h>
+
+#include "AlpsHIDTransport.hpp"
+
+class AlpsIOHIDTransport : public AlpsHIDTransport {
+public:
+    AlpsIOHIDTransport() : hid_interface(NULL) {}
+    
+    void setInterface(IOHIDInterface* interface) { hid_interface = interface; }
+    
+    IOReturn setFeatureReport(const UInt8 *report, UInt32 length) override;
+    IOReturn getFeatureReport(UInt8 *report, UInt32 length) override;
+    
+private:
+    IOHIDInterface* hid_interface;
+};
+
+#endif /* AlpsIOHIDTransport_hpp */
@@ -0,0 +1,388 @@
+//
+//  AlpsReferenceModel.hpp
+//  AlpsT4USB
+//
+//  The report handling the driver shipped with before it moved to compact frames, quirks
+//  included (T4 always reports five contacts and the button on every slot). Debug builds
+//  and the host harness run it next to the real pipeline and report any field that comes
+//  out different.
+//
+//  Everything the pipeline added since is modelled here again from the configuration, not
+//  taken from the decoder: coordinates are clamped, flipped, mirrored and turned one step at
+//  a time, palm-zone contacts are dropped while typing until the quiet time ends or they
+//  travel, and the thumb and resting fingers are tracked per contact. Contacts that are
+//  dropped or resting are modelled as lifted. Written slot by slot on purpose, so a slip in
+//  the decoder's bit masks or its transform matrix does not show up here as well.
+//
+
+#ifndef AlpsReferenceModel_hpp
+#define AlpsReferenceModel_hpp
+
+#include "AlpsDecoder.hpp"
+#include "AlpsEventEmitter.hpp"
+
+template <typename Event>
+class AlpsReferenceModel {
+public:
+    AlpsReferenceModel() : type(T4), geometry(), quarter_turns(0), invert_x(false), invert_y(false), quiet_time(0),
+                           palm_everywhere(true), palm_left(0), palm_right(0), palm_top(0), palm_bottom(0),
+                           thumb_zone_top(0), resting_dwell(0), resting_travel(0), thumb(-1), last_button(0) {
+        memset(&message, 0, sizeof(Event));
+        memset(contacts, 0, sizeof(contacts));
+    }
+    
+    /* The settings alps_configure_transform() was given */
+    void configure(dev_num type, const alps_dev &geometry, UInt32 quarter_turns, bool invert_x, bool invert_y) {
+        this->type = type;
+        this->geometry = geometry;
+        this->quarter_turns = quarter_turns % 4;
+        this->invert_x = invert_x;
+        this->invert_y = invert_y;
+    }
+    
+    /* The settings alps_configure_palm_zones() was given, and the decoder's max_after_typing */
+    void configure_palm_zones(UInt32 left, UInt32 right, UInt32 top, UInt32 bottom, uint64_t quiet_time) {
+        this->quiet_time = quiet_time;
+        
+        palm_everywhere = !left && !right && !top && !bottom;
+        palm_left = min_x() + width() * percent(left) / 100;
+        palm_right = max_x() - width() * percent(right) / 100;
+        palm_top = min_y() + height() * percent(top) / 100;
+        palm_bottom = max_y() - height() * percent(bottom) / 100;
+    }
+    
+    /* The settings alps_configure_classifier() was given */
+    void configure_classifier(UInt32 thumb_zone, uint64_t resting_dwell, UInt32 resting_travel) {
+        thumb_zone_top = max_y() - height() * percent(thumb_zone) / 100;
+        this->resting_dwell = resting_dwell;
+        this->resting_travel = resting_travel;
+    }
+    
+    void t4_event(const t4_input_report &reportData, AbsoluteTime key_time, AbsoluteTime timestamp) {
+        bool down[MAX_TOUCHES];
+        UInt32 x[MAX_TOUCHES], y[MAX_TOUCHES];
+        
+        for (int i = 0; i < MAX_TOUCHES; i++) {
+            map(reportData.contact[i].x_hi << 8 | reportData.contact[i].x_lo,
+                reportData.contact[i].y_hi << 8 | reportData.contact[i].y_lo, x[i], y[i]);
+            down[i] = reportData.contact[i].palm < 0x80 && reportData.contact[i].palm > 0;
+        }
+        
+        classify(down, x, y, reportData.button, key_time, timestamp);
+        
+        int contactCount = 0;
+        for (int i = 0; i < MAX_TOUCHES; i++) {
+            auto &transducer = message.transducers[i];
+            bool contactValid = contacts[i].touching && !contacts[i].resting;
+            
+            set_finger(i);
+            
+            transducer.isValid = contactValid;
+            transducer.timestamp = timestamp;
+            transducer.supportsPressure = false;
+            
+            if (contactValid) {
+                transducer.isTransducerActive = true;
+                
+                transducer.previousCoordinates = transducer.currentCoordinates;
+                transducer.currentCoordinates.x = x[i];
+                transducer.currentCoordinates.y = y[i];
+                
+                transducer.isPhysicalButtonDown = reportData.button;
+                
+                contactCount += 1;
+            } else {
+                transducer.isTransducerActive = false;
+                transducer.currentCoordinates = transducer.previousCoordinates;
+                transducer.isPhysicalButtonDown = reportData.button;
+            }
+        }
+        
+        message.contact_count = MAX_TOUCHES;
+        message.timestamp = timestamp;
+    }
+    
+    void u1_event(const UInt8 *data, AbsoluteTime key_time, AbsoluteTime timestamp) {
+        bool down[MAX_TOUCHES];
+        UInt32 x[MAX_TOUCHES], y[MAX_TOUCHES];
+        
+        for (int i = 0; i < MAX_TOUCHES; i++) {
+            const UInt8 *contact = &data[i * 5];
+            map(contact[3] | contact[4] << 8, contact[5] | contact[6] << 8, x[i], y[i]);
+            down[i] = contact[7] & 0x7F;
+        }
+        
+        classify(down, x, y, data[1] & 0x1, key_time, timestamp);
+        
+        int contactCount = 0;
+        for (int i = 0; i < MAX_TOUCHES; i++) {
+            auto &transducer = message.transducers[i];
+            bool contactValid = contacts[i].touching && !contacts[i].resting;
+            
+            set_finger(i);
+            
+            transducer.isValid = contactValid;
+            transducer.timestamp = timestamp;
+            transducer.supportsPressure = false;
+            
+            if (contactValid) {
+                transducer.isTransducerActive = true;
+                
+                transducer.previousCoordinates = transducer.currentCoordinates;
+                transducer.currentCoordinates.x = x[i];
+                transducer.currentCoordinates.y = y[i];
+                
+                transducer.isPhysicalButtonDown = data[1] & 0x1;
+                
+                contactCount += 1;
+            } else {
+                transducer.isTransducerActive = false;
+                transducer.currentCoordinates = transducer.previousCoordinates;
+                transducer.isPhysicalButtonDown = false;
+            }
+        }
+        
+        message.contact_count = contactCount;
+        message.timestamp = timestamp;
+    }
+    
+    /* Start over from what the driver emitted, after a divergence has been reported */
+    void resync(const Event &actual) {
+        message = actual;
+    }
+    
+    /* Name of the first field that differs, slot is -1 for event-level fields */
+    const char* compare(const Event &actual, int &slot) const {
+        slot = -1;
+        
+        if (actual.contact_count != message.contact_count)
+            return "contact_count";
+        if (actual.timestamp != message.timestamp)
+            return "timestamp";
+        
+        for (slot = 0; slot < MAX_TOUCHES; slot++) {
+            const auto &a = actual.transducers[slot];
+            const auto &e = message.transducers[slot];
+            
+            if (a.isValid != e.isValid)
+                return "isValid";
+            if (a.isTransducerActive != e.isTransducerActive)
+                return "isTransducerActive";
+            if (a.isPhysicalButtonDown != e.isPhysicalButtonDown)
+                return "isPhysicalButtonDown";
+            if (a.type != e.type)
+                return "type";
+            if (a.secondaryId != e.secondaryId)
+                return "secondaryId";
+            if (a.supportsPressure != e.supportsPressure)
+                return "supportsPressure";
+            if (a.timestamp != e.timestamp)
+                return "timestamp";
+            if (a.currentCoordinates.x != e.currentCoordinates.x || a.currentCoordinates.y != e.currentCoordinates.y)
+                return "currentCoordinates";
+            if (a.previousCoordinates.x != e.previousCoordinates.x || a.previousCoordinates.y != e.previousCoordinates.y)
+                return "previousCoordinates";
+            if (a.fingerType != e.fingerType)
+                return "fingerType";
+        }
+        
+        slot = -1;
+        return NULL;
+    }
+    
+private:
+    /* Everything known about one slot, from the contact landing to it lifting */
+    struct contact_state {
+        bool palm;              /* landed in a palm zone while typing, and not let through yet */
+        UInt32 palm_x;
+        UInt32 palm_y;
+        bool touching;          /* down and not a palm in the last report */
+        AbsoluteTime landed;    /* when and where it started touching */
+        UInt32 landed_x;
+        UInt32 landed_y;
+        bool low;               /* started touching in the thumb zone */
+        bool settled;           /* moved past resting_travel or became the thumb, never resting again */
+        bool resting;
+    };
+    
+    static UInt32 percent(UInt32 value) {
+        return value > 100 ? 100 : value;
+    }
+    
+    static UInt32 clamp(UInt32 value, UInt32 min, UInt32 max) {
+        return value < min ? min : value > max ? max : value;
+    }
+    
+    static UInt32 distance(UInt32 x0, UInt32 y0, UInt32 x1, UInt32 y1) {
+        return (x1 > x0 ? x1 - x0 : x0 - x1) + (y1 > y0 ? y1 - y0 : y0 - y1);
+    }
+    
+    /* Reported bounds, a quarter turn either way swaps the axes */
+    UInt32 min_x() const { return quarter_turns & 1 ? geometry.y_min : geometry.x_min; }
+    UInt32 max_x() const { return quarter_turns & 1 ? geometry.y_max : geometry.x_max; }
+    UInt32 min_y() const { return quarter_turns & 1 ? geometry.x_min : geometry.y_min; }
+    UInt32 max_y() const { return quarter_turns & 1 ? geometry.x_max : geometry.y_max; }
+    UInt32 width() const { return max_x() - min_x(); }
+    UInt32 height() const { return max_y() - min_y(); }
+    
+    /* Device to reported coordinates, one step at a time */
+    void map(UInt32 raw_x, UInt32 raw_y, UInt32 &x, UInt32 &y) const {
+        UInt32 device_x = clamp(raw_x, geometry.x_min, geometry.x_max);
+        UInt32 device_y = clamp(raw_y, geometry.y_min, geometry.y_max);
+        
+        // T4 y grows upwards
+        if (type == T4)
+            device_y = geometry.y_max - (device_y - geometry.y_min);
+        
+        if (invert_x)
+            device_x = geometry.x_max - (device_x - geometry.x_min);
+        if (invert_y)
+            device_y = geometry.y_max - (device_y - geometry.y_min);
+        
+        switch (quarter_turns) {
+            case 0:
+                x = device_x;
+                y = device_y;
+                break;
+            case 1:
+                // Clockwise: the top edge becomes the right edge, the left edge the top
+                x = geometry.y_max - (device_y - geometry.y_min);
+                y = device_x;
+                break;
+            case 2:
+                x = geometry.x_max - (device_x - geometry.x_min);
+                y = geometry.y_max - (device_y - geometry.y_min);
+                break;
+            case 3:
+                // The top edge becomes the left edge, the left edge the bottom
+                x = device_y;
+                y = geometry.x_max - (device_x - geometry.x_min);
+                break;
+        }
+    }
+    
+    bool in_palm_zone(UInt32 x, UInt32 y) const {
+        bool inside = x >= palm_left && x <= palm_right && y >= palm_top && y <= palm_bottom;
+        return palm_everywhere || !inside;
+    }
+    
+    /* Typing suppression, then thumb and resting fingers, for the contacts down in this report */
+    void classify(const bool *down, const UInt32 *x, const UInt32 *y, bool pressed, AbsoluteTime key_time, AbsoluteTime timestamp) {
+        bool typing = timestamp - key_time < quiet_time;
+        bool changed = false;
+        int touching = 0;
+        
+        for (int i = 0; i < MAX_TOUCHES; i++) {
+            contact_state &contact = contacts[i];
+            bool was_touching = contact.touching;
+            bool was_down = contact.touching || contact.palm;
+            
+            if (!down[i]) {
+                contact.palm = false;
+            } else if (!was_down) {
+                contact.palm = typing && in_palm_zone(x[i], y[i]);
+                contact.palm_x = x[i];
+                contact.palm_y = y[i];
+            } else if (contact.palm && (!typing || distance(contact.palm_x, contact.palm_y, x[i], y[i]) > PALM_RELEASE_TRAVEL)) {
+                contact.palm = false;
+            }
+            
+            contact.touching = down[i] && !contact.palm;
+            
+            if (contact.touching != was_touching)
+                changed = true;
+            
+            if (!contact.touching) {
+                contact.resting = false;
+                if (thumb == i)
+                    thumb = -1;
+                continue;
+            }
+            
+            touching++;
+            
+            if (!was_touching) {
+                contact.landed = timestamp;
+                contact.landed_x = x[i];
+                contact.landed_y = y[i];
+                contact.low = y[i] > thumb_zone_top;
+                contact.settled = false;
+                contact.resting = false;
+            } else if (resting_dwell && !contact.settled) {
+                if (distance(contact.landed_x, contact.landed_y, x[i], y[i]) > resting_travel) {
+                    contact.settled = true;
+                    contact.resting = false;
+                } else if (timestamp - contact.landed >= resting_dwell) {
+                    contact.resting = true;
+                }
+            }
+        }
+        
+        // T4 reports the button on every slot, U1 only on the touching ones, and the first slot's
+        // button is what the legacy scan looked at
+        UInt8 button = 0;
+        for (int i = 0; i < MAX_TOUCHES; i++) {
+            if (pressed && (type == T4 || contacts[i].touching))
+                button |= BIT(i);
+        }
+        if (button != last_button)
+            changed = true;
+        last_button = button;
+        
+        if (thumb < 0 && changed && touching && (touching >= 4 || (button & BIT(0))))
+            pick_thumb(y);
+    }
+    
+    /* The lowest contact, among those that started in the thumb zone if any did; the last slot wins a tie */
+    void pick_thumb(const UInt32 *y) {
+        bool any_low = false;
+        for (int i = 0; i < MAX_TOUCHES; i++) {
+            if (contacts[i].touching && contacts[i].low)
+                any_low = true;
+        }
+        
+        for (int i = MAX_TOUCHES - 1; i >= 0; i--) {
+            if (!contacts[i].touching || (any_low && !contacts[i].low))
+                continue;
+            if (thumb < 0 || y[i] > y[thumb])
+                thumb = i;
+        }
+        
+        contacts[thumb].settled = true;
+        contacts[thumb].resting = false;
+    }
+    
+    void set_finger(int slot) {
+        typedef alps_event_traits<Event> traits;
+        auto &transducer = message.transducers[slot];
+        
+        transducer.type = traits::transducer();
+        transducer.fingerType = slot == thumb ? traits::thumb() : traits::finger(slot);
+        transducer.secondaryId = slot;
+    }
+    
+    Event message;
+    
+    dev_num type;
+    alps_dev geometry;
+    UInt32 quarter_turns;
+    bool invert_x;
+    bool invert_y;
+    
+    uint64_t quiet_time;
+    bool palm_everywhere;
+    UInt32 palm_left;
+    UInt32 palm_right;
+    UInt32 palm_top;
+    UInt32 palm_bottom;
+    
+    UInt32 thumb_zone_top;
+    uint64_t resting_dwell;
+    UInt32 resting_travel;
+    
+    contact_state contacts[MAX_TOUCHES];
+    int thumb;
+    UInt8 last_button;
+};
+
+#endif /* AlpsReferenceModel_hpp */
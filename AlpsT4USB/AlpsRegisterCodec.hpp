@@ -0,0 +1,242 @@
+//
+//  AlpsRegisterCodec.hpp
+//  AlpsT4USB
+//
+//  Encoders and decoders for the T4 and U1 register access feature reports. Everything
+//  is constexpr so frames for fixed addresses are built and checked at compile time.
+//
+
+#ifndef AlpsRegisterCodec_hpp
+#define AlpsRegisterCodec_hpp
+
+#include <IOKit/IOTypes.h>
+
+#define T4_FEATURE_REPORT_LEN       51   /* same as sizeof(struct t4_input_report) */
+#define T4_FEATURE_REPORT_ID        0x07
+#define T4_CMD_REGISTER_READ        0x08
+#define T4_CMD_REGISTER_WRITE       0x07
+
+#define U1_FEATURE_REPORT_ID        0x05 /* Feature ReportID */
+#define U1_FEATURE_REPORT_LEN       0x08 /* Feature Report Length */
+#define U1_FEATURE_REPORT_LEN_ALL   0x0A
+#define U1_CMD_REGISTER_READ        0xD1
+#define U1_CMD_REGISTER_WRITE       0xD2
+
+enum alps_register_status {
+    kAlpsRegisterOK,
+    kAlpsRegisterAddressMismatch,
+    kAlpsRegisterSizeMismatch,
+    kAlpsRegisterChecksumMismatch
+};
+
+struct t4_register_frame {
+    UInt8 bytes[T4_FEATURE_REPORT_LEN];
+};
+
+struct u1_register_frame {
+    UInt8 bytes[U1_FEATURE_REPORT_LEN];
+};
+
+constexpr UInt16 alps_get_le16(const UInt8 *p) {
+    return p[0] | p[1] << 8;
+}
+
+constexpr UInt32 alps_get_le32(const UInt8 *p) {
+    return (UInt32) p[0] | (UInt32) p[1] << 8 | (UInt32) p[2] << 16 | (UInt32) p[3] << 24;
+}
+
+constexpr void alps_put_le32(UInt32 val, UInt8 *p) {
+    p[0] = (UInt8) val;
+    p[1] = (UInt8) (val >> 8);
+    p[2] = (UInt8) (val >> 16);
+    p[3] = (UInt8) (val >> 24);
+}
+
+/*
+ * Fletcher-16 as the T4 expects it, both sums starting at 0xFF. Four bytes are taken
+ * per step: sum2 gains sum1 four times plus each byte weighted by the number of steps
+ * it would have spent in sum1. Folding with end-around carries every 20 bytes, as
+ * hid-alps does, always ends in 1..255, so a single reduction into that range at the
+ * end gives the same result.
+ */
+constexpr UInt16 t4_check_sum(const UInt8 *buffer, unsigned long length) {
+    UInt32 sum1 = 0xFF, sum2 = 0xFF;
+    unsigned long i = 0;
+
+    for (; i + 4 <= length; i += 4) {
+        UInt32 b0 = buffer[i], b1 = buffer[i + 1], b2 = buffer[i + 2], b3 = buffer[i + 3];
+
+        sum2 += 4 * sum1 + 4 * b0 + 3 * b1 + 2 * b2 + b3;
+        sum1 += b0 + b1 + b2 + b3;
+    }
+
+    for (; i < length; i++) {
+        sum1 += buffer[i];
+        sum2 += sum1;
+    }
+
+    sum1 = (sum1 - 1) % 255 + 1;
+    sum2 = (sum2 - 1) % 255 + 1;
+
+    return (UInt16) (sum2 << 8 | sum1);
+}
+
+/* ID, command, le32 address, le16 size (1), value, le16 checksum of bytes 1-8 */
+constexpr t4_register_frame t4_encode_register(UInt8 cmd, UInt32 address, UInt8 value) {
+    t4_register_frame frame = {};
+
+    frame.bytes[0] = T4_FEATURE_REPORT_ID;
+    frame.bytes[1] = cmd;
+    alps_put_le32(address, frame.bytes + 2);
+    frame.bytes[6] = 1;
+    frame.bytes[7] = 0;
+    frame.bytes[8] = value;
+
+    UInt16 check_sum = t4_check_sum(frame.bytes + 1, 8);
+    frame.bytes[9] = (UInt8) check_sum;
+    frame.bytes[10] = (UInt8) (check_sum >> 8);
+    frame.bytes[11] = 0;
+
+    return frame;
+}
+
+constexpr t4_register_frame t4_encode_read(UInt32 address) {
+    return t4_encode_register(T4_CMD_REGISTER_READ, address, 0);
+}
+
+constexpr t4_register_frame t4_encode_write(UInt32 address, UInt8 value) {
+    return t4_encode_register(T4_CMD_REGISTER_WRITE, address, value);
+}
+
+constexpr UInt32 t4_frame_address(const t4_register_frame &frame) {
+    return alps_get_le32(frame.bytes + 2);
+}
+
+/* A read reply carries le32 address, le16 size, value and le16 checksum of those from byte 6 */
+constexpr alps_register_status t4_decode_read_reply(const t4_register_frame &reply, UInt32 address, UInt8 &value) {
+    if (alps_get_le32(reply.bytes + 6) != address)
+        return kAlpsRegisterAddressMismatch;
+
+    if (alps_get_le16(reply.bytes + 10) != 1)
+        return kAlpsRegisterSizeMismatch;
+
+    if (alps_get_le16(reply.bytes + 13) != t4_check_sum(reply.bytes + 6, 7))
+        return kAlpsRegisterChecksumMismatch;
+
+    value = reply.bytes[12];
+    return kAlpsRegisterOK;
+}
+
+/* ID, command, le32 address, value, byte sum seeded with the full report length */
+constexpr u1_register_frame u1_encode_register(UInt8 cmd, UInt32 address, UInt8 value) {
+    u1_register_frame frame = {};
+
+    frame.bytes[0] = U1_FEATURE_REPORT_ID;
+    frame.bytes[1] = cmd;
+    alps_put_le32(address, frame.bytes + 2);
+    frame.bytes[6] = value;
+
+    UInt8 check_sum = U1_FEATURE_REPORT_LEN_ALL;
+    for (int i = 0; i < U1_FEATURE_REPORT_LEN - 1; i++)
+        check_sum += frame.bytes[i];
+    frame.bytes[7] = check_sum;
+
+    return frame;
+}
+
+constexpr u1_register_frame u1_encode_read(UInt32 address) {
+    return u1_encode_register(U1_CMD_REGISTER_READ, address, 0);
+}
+
+constexpr u1_register_frame u1_encode_write(UInt32 address, UInt8 value) {
+    return u1_encode_register(U1_CMD_REGISTER_WRITE, address, value);
+}
+
+/* The U1 reply is not checked by the device protocol, the value sits where it was written */
+constexpr alps_register_status u1_decode_read_reply(const u1_register_frame &reply, UInt8 &value) {
+    value = reply.bytes[6];
+    return kAlpsRegisterOK;
+}
+
+/* Frames for fixed addresses, with the address checked against the register map */
+template <UInt32 Address>
+struct t4_read_frame {
+    static_assert((Address & 0xFFFF0000) == 0, "T4 register addresses are 16 bit");
+    static constexpr t4_register_frame value = t4_encode_read(Address);
+};
+
+template <UInt32 Address, UInt8 Value>
+struct t4_write_frame {
+    static_assert((Address & 0xFFFF0000) == 0, "T4 register addresses are 16 bit");
+    static constexpr t4_register_frame value = t4_encode_write(Address, Value);
+};
+
+template <UInt32 Address>
+struct u1_read_frame {
+    static_assert((Address & 0xFFFFFF00) == 0x00800000, "U1 registers live at 0x008000xx");
+    static constexpr u1_register_frame value = u1_encode_read(Address);
+};
+
+template <UInt32 Address>
+constexpr t4_register_frame t4_read_frame<Address>::value;
+
+template <UInt32 Address, UInt8 Value>
+constexpr t4_register_frame t4_write_frame<Address, Value>::value;
+
+template <UInt32 Address>
+constexpr u1_register_frame u1_read_frame<Address>::value;
+
+/* Golden vectors produced by the original hand-built encoders */
+namespace alps_codec_golden {
+    template <unsigned long N, typename Frame>
+    constexpr bool matches(const Frame &frame, const UInt8 (&golden)[N]) {
+        for (unsigned long i = 0; i < N; i++)
+            if (frame.bytes[i] != golden[i])
+                return false;
+        return true;
+    }
+
+    constexpr t4_register_frame t4_reply(UInt32 address, UInt8 value, UInt16 check_sum) {
+        t4_register_frame frame = {};
+        alps_put_le32(address, frame.bytes + 6);
+        frame.bytes[10] = 1;
+        frame.bytes[12] = value;
+        frame.bytes[13] = (UInt8) check_sum;
+        frame.bytes[14] = (UInt8) (check_sum >> 8);
+        return frame;
+    }
+
+    constexpr alps_register_status status(const t4_register_frame &reply, UInt32 address) {
+        UInt8 value = 0;
+        return t4_decode_read_reply(reply, address, value);
+    }
+
+    constexpr UInt8 decoded(const t4_register_frame &reply, UInt32 address) {
+        UInt8 value = 0;
+        t4_decode_read_reply(reply, address, value);
+        return value;
+    }
+
+    constexpr UInt8 t4_read_id_config_3[] = {0x07, 0x08, 0x70, 0xC3, 0x00, 0x00, 0x01, 0x00, 0x00, 0x3D, 0xEC, 0x00};
+    constexpr UInt8 t4_write_sys_config_1[] = {0x07, 0x07, 0xC2, 0xC2, 0x00, 0x00, 0x01, 0x00, 0x02, 0x8F, 0x21, 0x00};
+    constexpr UInt8 t4_write_feed_config_1[] = {0x07, 0x07, 0xC4, 0xC2, 0x00, 0x00, 0x01, 0x00, 0x78, 0x08, 0xA5, 0x00};
+    constexpr UInt8 t4_write_feed_config_4[] = {0x07, 0x07, 0xDA, 0xC2, 0x00, 0x00, 0x01, 0x00, 0x01, 0xA6, 0xC8, 0x00};
+    constexpr UInt8 u1_read_dev_ctrl_1[] = {0x05, 0xD1, 0x40, 0x00, 0x80, 0x00, 0x00, 0xA0};
+    constexpr UInt8 u1_write_dev_ctrl_1[] = {0x05, 0xD2, 0x40, 0x00, 0x80, 0x00, 0x82, 0x23};
+    constexpr UInt8 u1_read_device_typ[] = {0x05, 0xD1, 0x43, 0x00, 0x80, 0x00, 0x00, 0xA3};
+
+    static_assert(matches(t4_encode_read(0xC370), t4_read_id_config_3), "T4 read encoding changed");
+    static_assert(matches(t4_encode_write(0xC2C2, 0x02), t4_write_sys_config_1), "T4 write encoding changed");
+    static_assert(matches(t4_encode_write(0xC2C4, 0x78), t4_write_feed_config_1), "T4 write encoding changed");
+    static_assert(matches(t4_encode_write(0xC2DA, 0x01), t4_write_feed_config_4), "T4 write encoding changed");
+    static_assert(matches(u1_encode_read(0x00800040), u1_read_dev_ctrl_1), "U1 read encoding changed");
+    static_assert(matches(u1_encode_write(0x00800040, 0x82), u1_write_dev_ctrl_1), "U1 write encoding changed");
+    static_assert(matches(u1_encode_read(0x00800043), u1_read_device_typ), "U1 read encoding changed");
+
+    static_assert(status(t4_reply(0xC370, 0x5A, 0x078F), 0xC370) == kAlpsRegisterOK, "T4 reply decoding changed");
+    static_assert(decoded(t4_reply(0xC370, 0x5A, 0x078F), 0xC370) == 0x5A, "T4 reply decoding changed");
+    static_assert(status(t4_reply(0xC370, 0x5A, 0x078E), 0xC370) == kAlpsRegisterChecksumMismatch, "T4 reply checksum not checked");
+    static_assert(status(t4_reply(0xC371, 0x5A, 0x078F), 0xC370) == kAlpsRegisterAddressMismatch, "T4 reply address not checked");
+}
+
+#endif /* AlpsRegisterCodec_hpp */
@@ -0,0 +1,68 @@
+//
+//  AlpsT4FrameRing.h
+//  AlpsT4USB
+//
+//  Layout of the optional shared frame ring between AlpsT4USB and its multitouch client.
+//
+
+#ifndef AlpsT4FrameRing_h
+#define AlpsT4FrameRing_h
+
+#include <IOKit/IOMessage.h>
+
+/*
+ * A client that sets this property to true on itself is handed a ring instead of
+ * one kIOMessageVoodooInputMessage per report.
+ */
+#define ALPS_T4_FRAME_RING_SUPPORTED_KEY    "AlpsT4FrameRingSupported"
+
+/* argument is the IOBufferMemoryDescriptor* holding an AlpsT4FrameRing, retain it to keep it */
+#define kIOMessageAlpsT4FrameRingAttach     iokit_vendor_specific_msg(500)
+/* argument is the same descriptor, the driver is done writing it, stop reading from it before returning */
+#define kIOMessageAlpsT4FrameRingDetach     iokit_vendor_specific_msg(501)
+/* no argument, the ring went from empty to non-empty */
+#define kIOMessageAlpsT4FrameRingWakeup     iokit_vendor_specific_msg(502)
+
+#define ALPS_T4_FRAME_RING_VERSION          1
+#define ALPS_T4_FRAME_RING_CAPACITY         64      /* frames, power of two */
+#define ALPS_T4_FRAME_MAX_CONTACTS          5
+#define ALPS_T4_FRAME_NO_THUMB              0xFF
+
+struct AlpsT4Frame {
+    UInt64  timestamp;
+    UInt8   contact_count;      /* same meaning as VoodooInputEvent::contact_count */
+    UInt8   valid;              /* bit n set when contact n is touching */
+    UInt8   button;
+    UInt8   thumb;              /* contact index or ALPS_T4_FRAME_NO_THUMB */
+    UInt32  x[ALPS_T4_FRAME_MAX_CONTACTS];
+    UInt32  y[ALPS_T4_FRAME_MAX_CONTACTS];
+};
+
+/*
+ * Single producer, single consumer. head and tail are free-running counters on
+ * separate cache lines; a frame lives at frames[counter % capacity].
+ *
+ * The producer writes the frame, release-stores head, issues a full fence and
+ * loads tail. It sends kIOMessageAlpsT4FrameRingWakeup only if tail equalled the
+ * old head, i.e. the ring was empty. The consumer drains with acquire loads of
+ * head, release-stores tail, issues a full fence and re-checks head before going
+ * idle, so a frame published while it was finishing is never missed.
+ *
+ * When the ring is full the newest frame is dropped and counted in dropped.
+ */
+struct AlpsT4FrameRing {
+    UInt32  version;
+    UInt32  capacity;
+    UInt32  dropped;
+    UInt8   reserved0[52];
+
+    UInt32  head;
+    UInt8   reserved1[60];
+
+    UInt32  tail;
+    UInt8   reserved2[60];
+
+    struct AlpsT4Frame frames[ALPS_T4_FRAME_RING_CAPACITY];
+};
+
+#endif /* AlpsT4FrameRing_h */
@@ -0,0 +1,99 @@
+//
+//  AlpsT4Trace.hpp
+//  AlpsT4USB
+//
+//  kdebug tracepoints. A disabled probe is one predicted-not-taken branch on a flag owned by
+//  the driver instance; an enabled one writes a kdebug record that ktrace/trace can pick up
+//  with the class/subclass filter DBG_DRIVERS/ALPS_TRACE_SUBCLASS. Host builds hand the same
+//  records to a per-instance sink instead.
+//
+
+#ifndef AlpsT4Trace_hpp
+#define AlpsT4Trace_hpp
+
+#include <IOKit/IOTypes.h>
+
+#ifdef KERNEL
+#include <sys/kdebug.h>
+#else
+/* Host builds have no kdebug, records go to the sink set with AlpsTrace::setSink() */
+#define DBG_DRIVERS                 6
+#define DBG_FUNC_START              1
+#define DBG_FUNC_END                2
+#define DBG_FUNC_NONE               0
+#define KDBG_CODE(Class, SubClass, code) (((Class & 0xff) << 24) | ((SubClass & 0xff) << 16) | ((code & 0x3fff) << 2))
+#endif
+
+/* Boolean property, set through IORegistryEntrySetCFProperty to toggle tracing at runtime */
+#define ALPS_TRACE_ENABLED_KEY      "TraceEnabled"
+
+#define ALPS_TRACE_SUBCLASS         0xA7
+
+/* Every record carries the instance's registry entry ID as its last argument */
+enum alps_trace_point {
+    kAlpsTraceReport = 1,           /* report id, report type, length */
+    kAlpsTraceDecode,               /* valid, button, contact count, thumb */
+    kAlpsTraceDrop,                 /* alps_trace_drop, report id, report type */
+    kAlpsTraceEmit,                 /* START: valid, button / END / NONE when put in the frame ring: valid, dropped */
+    kAlpsTraceRegister,             /* START: address, command / END: address, IOReturn, value, alps_register_status */
+    kAlpsTracePower                 /* power state, awake */
+};
+
+enum alps_trace_drop {
+    kAlpsDropNotReady = 1,
+    kAlpsDropNotInput,
+    kAlpsDropForeignReport
+};
+
+#define ALPS_TRACE_CODE(point)      KDBG_CODE(DBG_DRIVERS, ALPS_TRACE_SUBCLASS, point)
+
+class AlpsTrace {
+public:
+#ifdef KERNEL
+    AlpsTrace() : enabled(false), tag(0) {}
+#else
+    /* Gets every record with the arguments kernel_debug would, code already includes func */
+    typedef void (*Sink)(void* context, UInt32 code, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t arg4, uintptr_t arg5);
+    
+    AlpsTrace() : enabled(false), tag(0), sink(NULL), sink_context(NULL) {}
+    
+    void setSink(Sink sink, void* context) {
+        this->sink = sink;
+        sink_context = context;
+    }
+#endif
+    
+    void setEnabled(bool on, uint64_t instance) {
+        tag = instance;
+        __atomic_store_n(&enabled, on, __ATOMIC_RELAXED);
+    }
+    
+    bool isEnabled() const {
+        return __atomic_load_n(&enabled, __ATOMIC_RELAXED);
+    }
+    
+    void record(UInt32 point, UInt32 func, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t arg4) const {
+#ifdef KERNEL
+        kernel_debug(ALPS_TRACE_CODE(point) | func, arg1, arg2, arg3, arg4, (uintptr_t) tag);
+#else
+        if (sink)
+            sink(sink_context, ALPS_TRACE_CODE(point) | func, arg1, arg2, arg3, arg4, (uintptr_t) tag);
+#endif
+    }
+    
+private:
+    bool enabled;
+    uint64_t tag;
+#ifndef KERNEL
+    Sink sink;
+    void* sink_context;
+#endif
+};
+
+/* A macro so the arguments are only evaluated when the probe fires */
+#define ALPS_TRACE(trace, point, func, arg1, arg2, arg3, arg4) do {     \
+    if (__builtin_expect((trace).isEnabled(), 0))                       \
+        (trace).record(point, func, (uintptr_t) (arg1), (uintptr_t) (arg2), (uintptr_t) (arg3), (uintptr_t) (arg4)); \
+} while (0)
+
+#endif /* AlpsT4Trace_hpp */
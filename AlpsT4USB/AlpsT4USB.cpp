@@ -9,77 +9,33 @@
 #define super IOHIDEventService
 OSDefineMetaClassAndStructors(AlpsT4USBEventDriver, IOHIDEventService);
 
-void AlpsT4USBEventDriver::t4_device_init() {
-    
-    ready = false;
-    
-    UInt8 tmp = '\0', sen_line_num_x, sen_line_num_y;
-    alps_dev pri_data;
-    IOReturn ret = kIOReturnSuccess;
-    
-    if (hid_interface->getProductID() == HID_PRODUCT_ID_T4_BTNLESS) {
-        ret = t4_read_write_register(T4_PRM_ID_CONFIG_3, &tmp, 0, true);
-        if (ret!=kIOReturnSuccess) {
-            IOLog("failed T4_PRM_ID_CONFIG_3 (%d)\n", ret);
-            goto exit;
-        }
-        sen_line_num_x = 16 + ((tmp & 0x0F) | (tmp & 0x08 ? 0xF0 : 0));
-        sen_line_num_y = 12 + (((tmp & 0xF0) >> 4) | (tmp & 0x80 ? 0xF0 : 0));
-        ret = t4_read_write_register(PRM_SYS_CONFIG_1, &tmp, 0, true);
-        if (ret!=kIOReturnSuccess) {
-            IOLog("failed PRM_SYS_CONFIG_1 (%d)\n", ret);
-            goto exit;
-        }
-    } else {
-        sen_line_num_x = 20;
-        sen_line_num_y = 12;
-    }
-    
-    pri_data.x_max = sen_line_num_x * T4_COUNT_PER_ELECTRODE;
-    pri_data.x_min = T4_COUNT_PER_ELECTRODE;
-    pri_data.y_max = sen_line_num_y * T4_COUNT_PER_ELECTRODE;
-    pri_data.y_min = T4_COUNT_PER_ELECTRODE;
-    pri_data.x_active_len_mm = pri_data.y_active_len_mm = 0;
-    pri_data.btn_cnt = 1;
+void AlpsT4USBEventDriver::handleInterruptReport(AbsoluteTime timestamp, IOMemoryDescriptor *report, IOHIDReportType report_type, UInt32 report_id) {
     
-    tmp |= 0x02;
+    ALPS_TRACE(trace, kAlpsTraceReport, DBG_FUNC_NONE, report_id, report_type, report ? report->getLength() : 0, 0);
     
-    ret = t4_read_write_register(PRM_SYS_CONFIG_1, NULL, tmp, false);
-    if (ret!=kIOReturnSuccess) {
-        IOLog("failed PRM_SYS_CONFIG_1 (%d)\n", ret);
-        goto exit;
-    }
+    if (recorder.isEnabled())
+        recorder.begin(timestamp, report, report_type, report_id);
     
-    ret = t4_read_write_register(T4_PRM_FEED_CONFIG_1, NULL, T4_I2C_ABS, false);
-    if (ret!=kIOReturnSuccess) {
-        IOLog("failed T4_PRM_FEED_CONFIG_1 (%d)\n", ret);
-        goto exit;
+    // Pointing stick reports skip the touchpad pipeline entirely
+    if (report_id == U1_SP_ABSOLUTE_REPORT_ID && device.has_stick && report_type == kIOHIDReportTypeInput) {
+        watchdog_foreign_reports = 0;
+        u1_sp_raw_event(timestamp, report);
+        recorder.end();
+        return;
     }
     
-    ret = t4_read_write_register(T4_PRM_FEED_CONFIG_4, NULL, T4_FEEDCFG4_ADVANCED_ABS_ENABLE, false);
-    if (ret!=kIOReturnSuccess) {
-        IOLog("failed T4_PRM_FEED_CONFIG_4 (%d)\n", ret);
-        goto exit;
+    // Let the watchdog know whether the device is still sending absolute reports
+    if (report_type == kIOHIDReportTypeInput) {
+        if (report_id == device.absolute_report_id) {
+            watchdog_foreign_reports = 0;
+            watchdog_report_seen = true;
+        } else if (++watchdog_foreign_reports == WATCHDOG_FOREIGN_REPORTS && watchdog_timer && awake) {
+            // Not while asleep, a report that was already on its way must not restart the timer
+            watchdog_timer->setTimeoutMS(watchdog_backoff_ms);
+        }
     }
-    pri_data.max_fingers = 5;
-
-    setProperty(VOODOO_INPUT_LOGICAL_MAX_X_KEY, pri_data.x_max, 32);
-    setProperty(VOODOO_INPUT_LOGICAL_MAX_Y_KEY, pri_data.y_max, 32);
-    
-    setProperty(VOODOO_INPUT_PHYSICAL_MAX_X_KEY, 10240, 32);
-    setProperty(VOODOO_INPUT_PHYSICAL_MAX_Y_KEY, 6140, 32);
     
-    ready = true;
-    return;
-    
-exit:
-    ready = false;
-    return;
-}
-
-void AlpsT4USBEventDriver::handleInterruptReport(AbsoluteTime timestamp, IOMemoryDescriptor *report, IOHIDReportType report_type, UInt32 report_id) {
-    
-    switch (dev_type) {
+    switch (device.type) {
         case T4:
             t4_raw_event(timestamp, report, report_type, report_id);
             break;
@@ -87,33 +43,36 @@ void AlpsT4USBEventDriver::handleInterruptReport(AbsoluteTime timestamp, IOMemor
             u1_raw_event(timestamp, report, report_type, report_id);
             break;
     }
+    
+    recorder.end();
 }
 
 bool AlpsT4USBEventDriver::start(IOService* provider) {
-    if (!super::start(provider))
-        return false;
-    
-    work_loop = this->getWorkLoop();
-    
-    if (!work_loop)
+    // Reports can arrive as soon as handleStart opens the interface, so set this up first
+    UInt64 threshold_us = 0;
+    if (OSNumber* number = OSDynamicCast(OSNumber, getProperty(ALPS_FLIGHT_RECORDER_THRESHOLD_KEY)))
+        threshold_us = number->unsigned64BitValue();
+    if (!recorder.configure(threshold_us))
+        IOLog("%s Could not allocate the flight recorder\n", getName());
+    
+    if (!super::start(provider)) {
+        recorder.free();
         return false;
+    }
     
-    work_loop->retain();
-    
-    command_gate = IOCommandGate::commandGate(this);
-    if (!command_gate) {
+    // handleStart has set up work_loop and command_gate by now
+    watchdog_timer = IOTimerEventSource::timerEventSource(this, OSMemberFunctionCast(IOTimerEventSource::Action, this, &AlpsT4USBEventDriver::watchdogTimeout));
+    if (!watchdog_timer) {
         return false;
     }
-    work_loop->addEventSource(command_gate);
+    work_loop->addEventSource(watchdog_timer);
     
-    max_after_typing = 500000000;
-    key_time = 0;
+    watchdog_backoff_ms = WATCHDOG_BACKOFF_MIN_MS;
+    watchdog_timer->setTimeoutMS(WATCHDOG_INTERVAL_MS);
     
-    // Read QuietTimeAfterTyping configuration value (if available)
-    OSNumber* quietTimeAfterTyping = OSDynamicCast(OSNumber, getProperty("QuietTimeAfterTyping"));
+    decoder.key_time = 0;
     
-    if (quietTimeAfterTyping != NULL)
-        max_after_typing = quietTimeAfterTyping->unsigned64BitValue() * 1000000;
+    trace.setEnabled(getProperty(ALPS_TRACE_ENABLED_KEY) == kOSBooleanTrue, getRegistryEntryID());
     
     setProperty("VoodooI2CServices Supported", kOSBooleanTrue);
     
@@ -126,127 +85,316 @@ bool AlpsT4USBEventDriver::handleStart(IOService* provider) {
     
     if (!hid_interface)
         return false;
-
-    if (hid_interface->getVendorID() != ALPS_VENDOR) {
+    
+    // The device keeps its own copy of the IDs, init never has to touch hid_interface, which didTerminate clears
+    if (!device.identify(hid_interface->getVendorID(), hid_interface->getProductID())) {
         hid_interface = NULL;
         return false;
     }
-
-    switch (hid_interface->getProductID()) {
-            
-        case HID_PRODUCT_ID_T4_USB:
-        case HID_PRODUCT_ID_G1:
-        case HID_PRODUCT_ID_T4_BTNLESS:
-            dev_type = T4;
-            break;
-        case HID_PRODUCT_ID_U1:
-        case HID_PRODUCT_ID_U1_DUAL:
-            dev_type = U1;
-            break;
-            
-        default:
-        {   hid_interface = NULL;
-            return false;
-        }
-     }
     
+    hid_transport.setInterface(hid_interface);
+    device.set_transport(&hid_transport);
+    device.set_trace(&trace);
+    decoder.trace = &trace;
     
     if (!hid_interface->open(this, 0, OSMemberFunctionCast(IOHIDInterface::InterruptReportAction, this, &AlpsT4USBEventDriver::handleInterruptReport), NULL))
         return false;
+    
+    // Init, wake and the watchdog all run register transactions, the gate keeps them from interleaving.
+    // It has to exist before the deferred init or power management can call in.
+    work_loop = getWorkLoop();
+    command_gate = work_loop ? IOCommandGate::commandGate(this) : NULL;
+    if (!command_gate || work_loop->addEventSource(command_gate) != kIOReturnSuccess) {
+        OSSafeReleaseNULL(command_gate);
+        hid_interface->close(this);
+        hid_interface = NULL;
+        return false;
+    }
+    work_loop->retain();
 
     name = getProductName();
     
     PMinit();
     
-    registerPowerDriver(this, VoodooI2CIOPMPowerStates, kVoodooI2CIOPMNumberPowerStates);
+    registerPowerDriver(this, power_states, kVoodooI2CIOPMNumberPowerStates);
 
     hid_interface->joinPMtree(this);
     
-    switch (dev_type) {
-        case T4:
-            t4_device_init();
-            break;
-        case U1:
-            u1_device_init();
-            break;
+    // Optionally publish now and talk to the hardware later, handleOpen waits for it
+    if (getProperty("DeferredDeviceInit") == kOSBooleanTrue) {
+        init_lock = IOLockAlloc();
+        init_thread_call = thread_call_allocate(&AlpsT4USBEventDriver::deferredDeviceInit, this);
+        
+        if (init_lock && init_thread_call) {
+            set_default_geometry();
+            
+            init_pending = true;
+            retain();
+            thread_call_enter(init_thread_call);
+            
+            publishMultitouchInterface();
+            
+            return true;
+        }
+        
+        IOLog("%s::%s Could not defer device init, initializing now\n", getName(), name);
     }
     
+    device_init();
+    
     publishMultitouchInterface();
     
     return true;
 }
 
+void AlpsT4USBEventDriver::device_init() {
+    command_gate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &AlpsT4USBEventDriver::gatedDeviceInit));
+}
+
+IOReturn AlpsT4USBEventDriver::gatedDeviceInit(void* arg0, void* arg1, void* arg2, void* arg3) {
+    const char* step = NULL;
+    
+    ready = false;
+    
+    IOReturn ret = device.device_init(&step);
+    if (ret != kIOReturnSuccess) {
+        IOLog("%s::%s Could not %s (%d)\n", getName(), name, step, ret);
+        return ret;
+    }
+    
+    configure_geometry(device.physical_max_x(), device.physical_max_y());
+    
+    ready = true;
+    return kIOReturnSuccess;
+}
+
+void AlpsT4USBEventDriver::set_default_geometry() {
+    device.set_default_geometry();
+    
+    configure_geometry(T4_PHYSICAL_MAX_X, T4_PHYSICAL_MAX_Y);
+}
+
+void AlpsT4USBEventDriver::deferredDeviceInit(thread_call_param_t param0, thread_call_param_t param1) {
+    AlpsT4USBEventDriver* self = (AlpsT4USBEventDriver*) param0;
+    
+    self->device_init();
+    
+    IOLockLock(self->init_lock);
+    self->init_pending = false;
+    IOLockWakeup(self->init_lock, &self->init_pending, false);
+    IOLockUnlock(self->init_lock);
+    
+    self->release();
+}
+
+void AlpsT4USBEventDriver::wait_for_device_init() {
+    if (!init_lock)
+        return;
+    
+    IOLockLock(init_lock);
+    while (init_pending)
+        IOLockSleep(init_lock, &init_pending, THREAD_UNINT);
+    IOLockUnlock(init_lock);
+}
+
 
 IOReturn AlpsT4USBEventDriver::setPowerState(unsigned long whichState, IOService* whatDevice) {
     if (whatDevice != this)
         return kIOReturnInvalid;
+    
+    wait_for_device_init();
+    
+    ALPS_TRACE(trace, kAlpsTracePower, DBG_FUNC_NONE, whichState, awake, 0, 0);
+    
     if (!whichState) {
-        if (awake)
-            awake = false;
+        // Neither the report path nor the timeout re-arm the watchdog once awake is clear, so at
+        // most a tick already under way fires after this, and the wake path starts it again
+        awake = false;
+        if (watchdog_timer)
+            watchdog_timer->cancelTimeout();
         IOLog("%s::%s Going to sleep\n", getName(), name);
     } else {
         if (!awake) {
             IOSleep(10);
             
             IOLog("%s::%s Awake, putting device in precision mode\n", getName(), name);
-            switch(dev_type){
-                case T4:
-                    t4_device_init();
-                    break;
-                case U1:
-                    u1_read_write_register(ADDRESS_U1_DEV_CTRL_1, NULL, U1_TP_ABS_MODE, false);
-                    break;
-            }
-            
+            command_gate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &AlpsT4USBEventDriver::gatedWakeDevice));
             
+            watchdog_foreign_reports = 0;
+            watchdog_silent_ticks = 0;
+            watchdog_backoff_ms = WATCHDOG_BACKOFF_MIN_MS;
             
+            // Before arming, a timeout that still saw awake clear would not re-arm itself
             awake = true;
+            if (watchdog_timer)
+                watchdog_timer->setTimeoutMS(WATCHDOG_INTERVAL_MS);
         }
     }
     return kIOPMAckImplied;
 }
 
+IOReturn AlpsT4USBEventDriver::gatedWakeDevice(void* arg0, void* arg1, void* arg2, void* arg3) {
+    switch(device.type){
+        case T4:
+            return gatedDeviceInit(arg0, arg1, arg2, arg3);
+        case U1:
+            return device.u1_read_write_register(ADDRESS_U1_DEV_CTRL_1, NULL, device.u1_dev_ctrl, false);
+    }
+    
+    return kIOReturnSuccess;
+}
 
-UInt16 AlpsT4USBEventDriver::t4_calc_check_sum(UInt8 *buffer, unsigned long offset, unsigned long length)
-{
-    UInt16 sum1 = 0xFF, sum2 = 0xFF;
-    unsigned long i = 0;
+
+// Runs on the work loop, so its own register reads are already serialized with the gated actions
+void AlpsT4USBEventDriver::watchdogTimeout(IOTimerEventSource* sender) {
+    if (!awake)
+        return;
     
-    if (offset + length >= 50)
-        return 0;
+    if (!ready) {
+        watchdog_timer->setTimeoutMS(WATCHDOG_INTERVAL_MS);
+        return;
+    }
     
-    while (length > 0) {
-        unsigned long tlen = length > 20 ? 20 : length;
-        
-        length -= tlen;
+    if (watchdog_foreign_reports >= WATCHDOG_FOREIGN_REPORTS) {
+        IOLog("%s::%s Device left absolute mode, restoring it\n", getName(), name);
+        restore_absolute_mode();
         
-        do {
-            sum1 += buffer[offset + i];
-            sum2 += sum1;
-            i++;
-        } while (--tlen > 0);
+        // Back off in case the device keeps dropping out, a valid report resets this
+        watchdog_foreign_reports = 0;
+        watchdog_backoff_ms = watchdog_backoff_ms * 2 > WATCHDOG_BACKOFF_MAX_MS ? WATCHDOG_BACKOFF_MAX_MS : watchdog_backoff_ms * 2;
+    } else if (watchdog_report_seen) {
+        watchdog_report_seen = false;
+        watchdog_silent_ticks = 0;
+        watchdog_backoff_ms = WATCHDOG_BACKOFF_MIN_MS;
+    } else if (++watchdog_silent_ticks == WATCHDOG_SILENT_TICKS) {
+        // An untouched pad is silent too, so check the mode register once before writing anything
+        OSBoolean* clamshell = OSDynamicCast(OSBoolean, getPMRootDomain()->getProperty(kAppleClamshellStateKey));
         
-        sum1 = (sum1 & 0xFF) + (sum1 >> 8);
-        sum2 = (sum2 & 0xFF) + (sum2 >> 8);
+        if (clamshell != kOSBooleanTrue && !device.in_absolute_mode()) {
+            IOLog("%s::%s Device is silent and not in absolute mode, restoring it\n", getName(), name);
+            restore_absolute_mode();
+        }
     }
     
-    sum1 = (sum1 & 0xFF) + (sum1 >> 8);
-    sum2 = (sum2 & 0xFF) + (sum2 >> 8);
+    if (awake)
+        watchdog_timer->setTimeoutMS(WATCHDOG_INTERVAL_MS);
+}
+
+IOReturn AlpsT4USBEventDriver::restore_absolute_mode() {
+    return command_gate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &AlpsT4USBEventDriver::gatedRestoreAbsoluteMode));
+}
+
+IOReturn AlpsT4USBEventDriver::gatedRestoreAbsoluteMode(void* arg0, void* arg1, void* arg2, void* arg3) {
+    IOReturn ret = device.restore_absolute_mode();
+    
+    if (ret != kIOReturnSuccess)
+        IOLog("%s::%s Could not restore absolute mode (%d)\n", getName(), name, ret);
     
-    return(sum2 << 8 | sum1);
+    return ret;
 }
 
 IOReturn AlpsT4USBEventDriver::publishMultitouchInterface() {
+    // Rotation is applied by the transform stage, so the coordinates VoodooInput gets are already upright
     setProperty("IOFBTransform", 0ull, 32);
     setProperty("VoodooInputSupported", kOSBooleanTrue);
     
     return kIOReturnSuccess;
 }
 
+void AlpsT4USBEventDriver::configure_geometry(UInt32 physical_max_x, UInt32 physical_max_y) {
+    configure_transform();
+    
+    // A quarter turn swaps the axes VoodooInput sees
+    if (decoder.transform.xx == 0) {
+        UInt32 tmp = physical_max_x;
+        physical_max_x = physical_max_y;
+        physical_max_y = tmp;
+    }
+    
+    setProperty(VOODOO_INPUT_LOGICAL_MAX_X_KEY, decoder.logical_max_x, 32);
+    setProperty(VOODOO_INPUT_LOGICAL_MAX_Y_KEY, decoder.logical_max_y, 32);
+    
+    setProperty(VOODOO_INPUT_PHYSICAL_MAX_X_KEY, physical_max_x, 32);
+    setProperty(VOODOO_INPUT_PHYSICAL_MAX_Y_KEY, physical_max_y, 32);
+    
+    configure_palm_zones();
+    configure_classifier();
+}
+
+void AlpsT4USBEventDriver::configure_transform() {
+    // TouchpadRotation is in degrees clockwise, TouchpadInvertX/TouchpadInvertY mirror the pad, see the README
+    UInt32 quarter_turns = 0;
+    
+    if (OSNumber* number = OSDynamicCast(OSNumber, getProperty("TouchpadRotation"))) {
+        UInt32 degrees = number->unsigned32BitValue();
+        
+        if (degrees % 90)
+            IOLog("%s::%s TouchpadRotation %u is not a multiple of 90 degrees, ignoring it\n", getName(), name, degrees);
+        else
+            quarter_turns = (degrees / 90) % 4;
+    }
+    
+    bool invert_x = getProperty("TouchpadInvertX") == kOSBooleanTrue;
+    bool invert_y = getProperty("TouchpadInvertY") == kOSBooleanTrue;
+    
+    alps_configure_transform(decoder, device.type, device.pri_data, quarter_turns, invert_x, invert_y);
+    
+#if DEBUG
+    reference.configure(device.type, device.pri_data, quarter_turns, invert_x, invert_y);
+#endif
+}
+
+void AlpsT4USBEventDriver::configure_palm_zones() {
+    // Zone widths are percentages of the pad measured in from each edge, see alps_configure_palm_zones()
+    UInt32 left = 0, right = 0, top = 0, bottom = 0;
+    uint64_t quiet_time_ns = 500000000;
+    
+    // Read QuietTimeAfterTyping configuration value (if available)
+    OSNumber* quietTimeAfterTyping = OSDynamicCast(OSNumber, getProperty("QuietTimeAfterTyping"));
+    
+    if (quietTimeAfterTyping != NULL)
+        quiet_time_ns = quietTimeAfterTyping->unsigned64BitValue() * 1000000;
+    
+    // Convert once here so the report path can compare raw report timestamps
+    nanoseconds_to_absolutetime(quiet_time_ns, &decoder.max_after_typing);
+    
+    if (OSNumber* number = OSDynamicCast(OSNumber, getProperty("PalmZoneLeft")))
+        left = number->unsigned32BitValue();
+    if (OSNumber* number = OSDynamicCast(OSNumber, getProperty("PalmZoneRight")))
+        right = number->unsigned32BitValue();
+    if (OSNumber* number = OSDynamicCast(OSNumber, getProperty("PalmZoneTop")))
+        top = number->unsigned32BitValue();
+    if (OSNumber* number = OSDynamicCast(OSNumber, getProperty("PalmZoneBottom")))
+        bottom = number->unsigned32BitValue();
+    
+    alps_configure_palm_zones(decoder, left, right, top, bottom);
+    
+#if DEBUG
+    reference.configure_palm_zones(left, right, top, bottom, decoder.max_after_typing);
+#endif
+}
+
 void AlpsT4USBEventDriver::handleStop(IOService* provider) {
+    wait_for_device_init();
+    if (init_thread_call) {
+        thread_call_free(init_thread_call);
+        init_thread_call = NULL;
+    }
+    if (init_lock) {
+        IOLockFree(init_lock);
+        init_lock = NULL;
+    }
+    
+    if (watchdog_timer) {
+        watchdog_timer->cancelTimeout();
+        work_loop->removeEventSource(watchdog_timer);
+        OSSafeReleaseNULL(watchdog_timer);
+    }
     work_loop->removeEventSource(command_gate);
     OSSafeReleaseNULL(command_gate);
     OSSafeReleaseNULL(work_loop);
+    
+    recorder.free();
 
     PMstop();
     super::handleStop(provider);
@@ -258,10 +406,10 @@ IOReturn AlpsT4USBEventDriver::message(UInt32 type, IOService* provider, void* a
     {
         case kKeyboardKeyPressTime:
         {
-            //  Remember last time key was pressed
-            key_time = *((uint64_t*)argument);
+            //  Remember last time key was pressed, the keyboard reports it in nanoseconds
+            nanoseconds_to_absolutetime(*((uint64_t*)argument), &decoder.key_time);
 #if DEBUG
-            IOLog("%s::keyPressed = %llu\n", getName(), key_time);
+            IOLog("%s::keyPressed = %llu\n", getName(), *((uint64_t*)argument));
 #endif
             break;
         }
@@ -270,6 +418,48 @@ IOReturn AlpsT4USBEventDriver::message(UInt32 type, IOService* provider, void* a
     return kIOReturnSuccess;
 }
 
+IOReturn AlpsT4USBEventDriver::setProperties(OSObject* properties) {
+    OSDictionary* dict = OSDynamicCast(OSDictionary, properties);
+    if (!dict)
+        return kIOReturnBadArgument;
+    
+    IOReturn ret = kIOReturnSuccess;
+    
+    // Tracing can be switched on and off without reloading
+    if (OSBoolean* tracing = OSDynamicCast(OSBoolean, dict->getObject(ALPS_TRACE_ENABLED_KEY))) {
+        trace.setEnabled(tracing == kOSBooleanTrue, getRegistryEntryID());
+        setProperty(ALPS_TRACE_ENABLED_KEY, tracing);
+    }
+    
+    // Publish the last flight recorder capture, if one finished since the last dump
+    if (dict->getObject(ALPS_FLIGHT_RECORDER_DUMP_KEY) == kOSBooleanTrue) {
+        OSData* capture = recorder.copyCapture();
+        if (capture) {
+            setProperty(ALPS_FLIGHT_RECORDER_CAPTURE_KEY, capture);
+            capture->release();
+        } else {
+            ret = kIOReturnNotFound;
+        }
+    }
+    
+    // Everything else goes to IOHIDEventService, without the keys handled here
+    OSDictionary* rest = OSDictionary::withDictionary(dict);
+    if (!rest)
+        return kIOReturnNoMemory;
+    
+    rest->removeObject(ALPS_TRACE_ENABLED_KEY);
+    rest->removeObject(ALPS_FLIGHT_RECORDER_DUMP_KEY);
+    
+    if (rest->getCount()) {
+        IOReturn super_ret = super::setProperties(rest);
+        if (ret == kIOReturnSuccess)
+            ret = super_ret;
+    }
+    
+    rest->release();
+    return ret;
+}
+
 bool AlpsT4USBEventDriver::init(OSDictionary *properties) {
     if (!super::init(properties)) {
         return false;
@@ -277,6 +467,14 @@ bool AlpsT4USBEventDriver::init(OSDictionary *properties) {
 
     awake = true;
     
+    power_states[kVoodooI2CStateOff] = {1, kIOPMPowerOff, kIOPMPowerOff, kIOPMPowerOff, 0, 0, 0, 0, 0, 0, 0, 0};
+    power_states[kVoodooI2CStateOn] = {1, kIOPMPowerOn, kIOPMPowerOn, kIOPMPowerOn, 0, 0, 0, 0, 0, 0, 0, 0};
+    
+    alps_reset_event(inputMessage, emitted);
+#if DEBUG
+    alps_reset_event(reference_event, reference_emitted);
+#endif
+    
     return true;
 }
 
@@ -288,435 +486,226 @@ const char* AlpsT4USBEventDriver::getProductName() {
 }
 
 bool AlpsT4USBEventDriver::didTerminate(IOService* provider, IOOptionBits options, bool* defer) {
+    // A deferred init still talks to the device, it has to be cancelled or finished before closing
+    if (init_thread_call && thread_call_cancel(init_thread_call)) {
+        IOLockLock(init_lock);
+        init_pending = false;
+        IOLockWakeup(init_lock, &init_pending, false);
+        IOLockUnlock(init_lock);
+        
+        release();
+    }
+    wait_for_device_init();
+    
     if (hid_interface)
         hid_interface->close(this);
     hid_interface = NULL;
+    hid_transport.setInterface(NULL);
     
     return super::didTerminate(provider, options, defer);
 }
 
 void AlpsT4USBEventDriver::t4_raw_event(AbsoluteTime timestamp, IOMemoryDescriptor *report, IOHIDReportType report_type, UInt32 report_id) {
     
-    uint64_t now_abs;
-    clock_get_uptime(&now_abs);
-    uint64_t now_ns;
-    absolutetime_to_nanoseconds(now_abs, &now_ns);
-    
-    // Ignore touchpad interaction(s) shortly after typing
-    if (now_ns - key_time < max_after_typing)
-        return;
-    
-    if (!ready || !report)
-        return;
-    
-    if (report_type != kIOHIDReportTypeInput)
-        return;
-    
-    if (report_id != T4_INPUT_REPORT_ID)
+    if (!alps_accept_report(decoder, ready && report, report_type == kIOHIDReportTypeInput, report_type, report_id))
         return;
     
     t4_input_report reportData;
-    
-    unsigned int x, y;
+    alps_frame frame;
     
     report->readBytes(0, &reportData, T4_INPUT_REPORT_LEN);
     
-    int contactCount = 0;
-    for (int i = 0; i < MAX_TOUCHES; i++) {
-        VoodooInputTransducer* transducer = &inputMessage.transducers[i];
-
-        transducer->fingerType = (MT2FingerType) (kMT2FingerTypeIndexFinger + (i % 4));
-        transducer->type = VoodooInputTransducerType::FINGER;
-        transducer->secondaryId = i;
-        
-        x = reportData.contact[i].x_hi << 8 | reportData.contact[i].x_lo;
-        y = reportData.contact[i].y_hi << 8 | reportData.contact[i].y_lo;
-        y = 3060 - y + 255;
-        bool contactValid= (reportData.contact[i].palm < 0x80 &&
-             reportData.contact[i].palm > 0) * 62;
-        
-        transducer->isValid = contactValid;
-        transducer->timestamp = timestamp;
-        transducer->supportsPressure = false;
-        
-        if (contactValid) {
-            transducer->isTransducerActive = true;
-            transducer->secondaryId = i;
-            
-            transducer->previousCoordinates = transducer->currentCoordinates;
-            transducer->currentCoordinates.x = x;
-            transducer->currentCoordinates.y = y;
-            
-            transducer->isPhysicalButtonDown = reportData.button;
-           
-            contactCount += 1;
-        } else {
-            transducer->isTransducerActive =  false;
-            transducer->secondaryId = i;
-            transducer->currentCoordinates = transducer->previousCoordinates;
-            transducer->isPhysicalButtonDown = reportData.button;
-        }
-    }
-    
-    inputMessage.contact_count = MAX_TOUCHES;
-    inputMessage.timestamp = timestamp;
-    
-    if (contactCount >= 4 || inputMessage.transducers->isPhysicalButtonDown) {
-        // simple thumb detection: to find the lowest finger touch in the vertical direction.
-        UInt32 y_max = 0;
-        int thumb_index = 0;
-        for (int i = 0; i < contactCount; i++) {
-            VoodooInputTransducer* inputTransducer = &inputMessage.transducers[i];
-            if (inputTransducer->isValid && inputTransducer->currentCoordinates.y >= y_max) {
-                y_max = inputTransducer->currentCoordinates.y;
-                thumb_index = i;
-            }
-        }
-        inputMessage.transducers[thumb_index].fingerType = kMT2FingerTypeThumb;
-    }
-
-    
-    
-    
-    super::messageClient(kIOMessageVoodooInputMessage, voodooInputInstance, &inputMessage, sizeof(VoodooInputEvent));
+    alps_t4_decode(decoder, reportData, timestamp, frame);
+    alps_classify_contacts(decoder, frame);
+    recorder.stampDecoded();
+    emit_frame(frame);
+#if DEBUG
+    reference.t4_event(reportData, decoder.key_time, timestamp);
+    check_reference(frame);
+#endif
 }
 
 void AlpsT4USBEventDriver::u1_raw_event(AbsoluteTime timestamp, IOMemoryDescriptor *report, IOHIDReportType report_type, UInt32 report_id) {
     
-    uint64_t now_abs;
-    clock_get_uptime(&now_abs);
-    uint64_t now_ns;
-    absolutetime_to_nanoseconds(now_abs, &now_ns);
-    
-    // Ignore touchpad interaction(s) shortly after typing
-    if (now_ns - key_time < max_after_typing)
+    if (!alps_accept_report(decoder, ready && report, report_type == kIOHIDReportTypeInput, report_type, report_id))
         return;
     
-    if (!ready || !report)
-        return;
+    UInt8 data[U1_ABSOLUTE_REPORT_LEN] = {};
+    alps_frame frame;
     
-    if (report_type != kIOHIDReportTypeInput)
-        return;
-    
-    if (report_id != U1_ABSOLUTE_REPORT_ID)
-        return;
-
-    unsigned int x, y, z;
-    
-    UInt8 data[sizeof(report)] = {};
-    report->readBytes(0, &data, sizeof(report));
+    report->readBytes(0, &data, U1_ABSOLUTE_REPORT_LEN);
     
-    int contactCount = 0;
-    for (int i = 0; i < MAX_TOUCHES; i++) {
-        VoodooInputTransducer* transducer = &inputMessage.transducers[i];
-        
-        transducer->type = VoodooInputTransducerType::FINGER;
-        transducer->fingerType = (MT2FingerType) (kMT2FingerTypeIndexFinger + (i % 4));
-        transducer->secondaryId = 3;
-        
-        UInt8 *contact = &data[i * 5];
-        x = get_unaligned_le16(contact + 3);
-        y = get_unaligned_le16(contact + 5);
-        z = contact[7] & 0x7F;
-        
-        bool contactValid = z;
-        transducer->isValid = contactValid;
-        transducer->timestamp = timestamp;
-        transducer->supportsPressure = false;
-        
-        if (contactValid) {
-            transducer->isTransducerActive = true;
-            transducer->secondaryId = i;
-            
-            transducer->previousCoordinates = transducer->currentCoordinates;
-            transducer->currentCoordinates.x = x;
-            transducer->currentCoordinates.y = y;
-            
-            transducer->isPhysicalButtonDown = data[1] & 0x1;
-           
-            contactCount += 1;
-        } else {
-            transducer->isTransducerActive =  false;
-            transducer->secondaryId = i;
-            transducer->currentCoordinates = transducer->previousCoordinates;
-            transducer->isPhysicalButtonDown = false;
-        }
-        
-        x = 0;
-        y = 0;
-        z = 0;
-    }
-    
-    inputMessage.contact_count = contactCount;
-    inputMessage.timestamp = timestamp;
-    
-    if (contactCount >= 4 || inputMessage.transducers->isPhysicalButtonDown) {
-        // simple thumb detection: to find the lowest finger touch in the vertical direction.
-        UInt32 y_max = 0;
-        int thumb_index = 0;
-        for (int i = 0; i < contactCount; i++) {
-            VoodooInputTransducer* inputTransducer = &inputMessage.transducers[i];
-            if (inputTransducer->isValid && inputTransducer->currentCoordinates.y >= y_max) {
-                y_max = inputTransducer->currentCoordinates.y;
-                thumb_index = i;
-            }
-        }
-        inputMessage.transducers[thumb_index].fingerType = kMT2FingerTypeThumb;
-    }
-
-       
-    super::messageClient(kIOMessageVoodooInputMessage, voodooInputInstance, &inputMessage, sizeof(VoodooInputEvent));
- }
+    alps_u1_decode(decoder, data, timestamp, frame);
+    alps_classify_contacts(decoder, frame);
+    recorder.stampDecoded();
+    emit_frame(frame);
+#if DEBUG
+    reference.u1_event(data, decoder.key_time, timestamp);
+    check_reference(frame);
+#endif
+}
 
-bool AlpsT4USBEventDriver::u1_device_init() {
-    
-    ready = false;
+void AlpsT4USBEventDriver::configure_classifier() {
+    // ThumbZoneBottom is a percentage of the pad height, RestingFingerDwellTime is in ms
+    // and RestingFingerTravel in logical units; a dwell time of 0 turns resting detection off
+    UInt32 thumb_zone = THUMB_ZONE_DEFAULT_PERCENT;
+    UInt32 resting_travel = RESTING_TRAVEL_DEFAULT;
+    UInt64 dwell_ms = 0;
+    uint64_t resting_dwell;
     
-    UInt8 tmp, dev_ctrl, sen_line_num_x, sen_line_num_y;
-    UInt8 pitch_x, pitch_y, resolution;
-    alps_dev pri_data;
-    IOReturn ret = kIOReturnSuccess;
+    if (OSNumber* number = OSDynamicCast(OSNumber, getProperty("ThumbZoneBottom")))
+        thumb_zone = number->unsigned32BitValue();
+    if (OSNumber* number = OSDynamicCast(OSNumber, getProperty("RestingFingerDwellTime")))
+        dwell_ms = number->unsigned64BitValue();
+    if (OSNumber* number = OSDynamicCast(OSNumber, getProperty("RestingFingerTravel")))
+        resting_travel = number->unsigned32BitValue();
     
-    /* Device initialization */
-    ret = u1_read_write_register(ADDRESS_U1_DEV_CTRL_1, &dev_ctrl, 0, true);
-    if (ret != kIOReturnSuccess) {
-        IOLog("%s::%s Could not read device mode\n", getName(), name);
-        goto exit;
-    }
+    nanoseconds_to_absolutetime(dwell_ms * 1000000, &resting_dwell);
     
-    dev_ctrl &= ~U1_DISABLE_DEV;
-    dev_ctrl |= U1_TP_ABS_MODE;
+    alps_configure_classifier(decoder, thumb_zone, resting_dwell, resting_travel);
     
-    u1_read_write_register(ADDRESS_U1_DEV_CTRL_1, NULL, dev_ctrl, false);
-    if (ret != kIOReturnSuccess) {
-        IOLog("%s::%s Could not put device in absolute mode\n", getName(), name);
-        goto exit;
-    }
+#if DEBUG
+    reference.configure_classifier(thumb_zone, resting_dwell, resting_travel);
+#endif
+}
 
-    u1_read_write_register(ADDRESS_U1_NUM_SENS_X, &sen_line_num_x, 0, true);
-    if (ret != kIOReturnSuccess) {
-        IOLog("%s::%s Could not read sen_line_num_x\n", getName(), name);
-        goto exit;
-    }
-    
-    u1_read_write_register(ADDRESS_U1_NUM_SENS_Y, &sen_line_num_y, 0, true);
-    if (ret != kIOReturnSuccess) {
-        IOLog("%s::%s Could not read sen_line_num_y\n", getName(), name);
-        goto exit;
-    }
+void AlpsT4USBEventDriver::u1_sp_raw_event(AbsoluteTime timestamp, IOMemoryDescriptor *report) {
     
-    u1_read_write_register(ADDRESS_U1_PITCH_SENS_X, &pitch_x, 0, true);
-    if (ret != kIOReturnSuccess) {
-        IOLog("%s::%s Could not read pitch_sens_x\n", getName(), name);
-        goto exit;
-    }
-    
-    u1_read_write_register(ADDRESS_U1_PITCH_SENS_Y, &pitch_y, 0, true);
-    if (ret != kIOReturnSuccess) {
-        IOLog("%s::%s Could not read pitch_sens_y\n", getName(), name);
-        goto exit;
-    }
+    if (!ready || !report)
+        return;
     
-    u1_read_write_register(ADDRESS_U1_RESO_DWN_ABS, &resolution, 0, true);
-    if (ret != kIOReturnSuccess) {
-        IOLog("%s::%s Could not read absolute mode resolution\n", getName(), name);
-        goto exit;
-    }
-
-    pri_data.x_active_len_mm = (pitch_x * (sen_line_num_x - 1)) / 10;
-    pri_data.y_active_len_mm = (pitch_y * (sen_line_num_y - 1)) / 10;
+    UInt8 data[U1_SP_REPORT_LEN] = {};
+    report->readBytes(0, &data, U1_SP_REPORT_LEN);
     
-    pri_data.x_max = (resolution << 2) * (sen_line_num_x - 1);
-    pri_data.x_min = 1;
-    pri_data.y_max = (resolution << 2) * (sen_line_num_y - 1);
-    pri_data.y_min = 1;
+    SInt16 sp_x = (SInt16) get_unaligned_le16(data + 2);
+    SInt16 sp_y = (SInt16) get_unaligned_le16(data + 4);
     
-    u1_read_write_register(ADDRESS_U1_PAD_BTN, &tmp, 0, true);
-    if (ret != kIOReturnSuccess) {
-        IOLog("%s::%s Could not read button count\n", getName(), name);
-        goto exit;
-    }
+    // Bits 0-2 are left, right and middle, the same order IOHIDEventService expects
+    dispatchRelativePointerEvent(timestamp, sp_x / 8, sp_y / 8, data[1] & 0x07);
+}
 
-    if ((tmp & 0x0F) == (tmp & 0xF0) >> 4) {
-        pri_data.btn_cnt = (tmp & 0x0F);
-    } else {
-        /* Button pad */
-        pri_data.btn_cnt = 1;
-    }
-    
-    setProperty(VOODOO_INPUT_LOGICAL_MAX_X_KEY, pri_data.x_max, 32);
-    setProperty(VOODOO_INPUT_LOGICAL_MAX_Y_KEY, pri_data.y_max, 32);
-       
-    setProperty(VOODOO_INPUT_PHYSICAL_MAX_X_KEY, pri_data.x_active_len_mm * 10, 32);
-    setProperty(VOODOO_INPUT_PHYSICAL_MAX_Y_KEY, pri_data.y_active_len_mm * 10, 32);
+UInt16 AlpsT4USBEventDriver::get_unaligned_le16(const void *p)
+{
+    return __get_unaligned_le16((const UInt8 *)p);
+}
 
-    ready = true;
-    return true;
-    
-exit:
-    ready = false;
-    return false;
-    
+UInt16 AlpsT4USBEventDriver::__get_unaligned_le16(const UInt8 *p)
+{
+    return p[0] | p[1] << 8;
 }
 
-IOReturn AlpsT4USBEventDriver::u1_read_write_register(UInt32 address, UInt8 *read_val, UInt8 write_val, bool read_flag) {
-    
-    UInt8 check_sum;
-    UInt8 input[U1_FEATURE_REPORT_LEN] = {};
-    UInt8 readbuf[U1_FEATURE_REPORT_LEN] = {};
-    IOReturn ret = kIOReturnSuccess;
-    
-    
-    input[0] = U1_FEATURE_REPORT_ID;
-    if (read_flag) {
-        input[1] = U1_CMD_REGISTER_READ;
-        input[6] = 0x00;
-    } else {
-        input[1] = U1_CMD_REGISTER_WRITE;
-        input[6] = write_val;
-    }
-    
-    put_unaligned_le32(address, input + 2);
-    
-    /* Calculate the checksum */
-    check_sum = U1_FEATURE_REPORT_LEN_ALL;
-    for (int i = 0; i < U1_FEATURE_REPORT_LEN - 1; i++)
-        check_sum += input[i];
-    
-    input[7] = check_sum;
-    
-    
-    
-    OSData* input_updated = OSData::withBytes(input, U1_FEATURE_REPORT_LEN);
-    IOBufferMemoryDescriptor* report = IOBufferMemoryDescriptor::withBytes(input_updated->getBytesNoCopy(0, U1_FEATURE_REPORT_LEN), input_updated->getLength(), kIODirectionInOut);
-    
-    input_updated->release();
-    
-    ret = hid_interface->setReport(report, kIOHIDReportTypeFeature, U1_FEATURE_REPORT_ID);
-    
-    if (read_flag) {
-        
-        ret = hid_interface->getReport(report, kIOHIDReportTypeFeature, U1_FEATURE_REPORT_ID);
+bool AlpsT4USBEventDriver::handleOpen(IOService *forClient, IOOptionBits options, void *arg) {
+    if (forClient && forClient->getProperty(VOODOO_INPUT_IDENTIFIER)) {
+        voodooInputInstance = forClient;
+        voodooInputInstance->retain();
         
-        report->readBytes(0, &readbuf, U1_FEATURE_REPORT_LEN);
+        // VoodooInput read the default geometry at its start, have it pick up the real one
+        if (init_lock) {
+            wait_for_device_init();
+#ifdef kIOMessageVoodooInputUpdatePropertiesNotification
+            super::messageClient(kIOMessageVoodooInputUpdatePropertiesNotification, voodooInputInstance);
+#endif
+#ifdef kIOMessageVoodooInputUpdateDimensionsMessage
+            VoodooInputDimensions dimensions = {(SInt32) decoder.logical_min_x, (SInt32) decoder.logical_max_x, (SInt32) decoder.logical_min_y, (SInt32) decoder.logical_max_y};
+            super::messageClient(kIOMessageVoodooInputUpdateDimensionsMessage, voodooInputInstance, &dimensions, sizeof(VoodooInputDimensions));
+#endif
+        }
         
-        *read_val = readbuf[6];
+        if (forClient->getProperty(ALPS_T4_FRAME_RING_SUPPORTED_KEY) == kOSBooleanTrue)
+            attach_frame_ring();
         
+        return true;
     }
     
-    report->release();
-    
-    return ret;
+    return super::handleOpen(forClient, options, arg);
 }
 
-IOReturn AlpsT4USBEventDriver::t4_read_write_register(UInt32 address, UInt8 *read_val, UInt8 write_val, bool read_flag) {
+void AlpsT4USBEventDriver::handleClose(IOService *forClient, IOOptionBits options) {
+    detach_frame_ring();
     
-    UInt16 check_sum;
-    UInt8 input[T4_FEATURE_REPORT_LEN] = {};
-    UInt8 readbuf[T4_FEATURE_REPORT_LEN] = {};
-    IOReturn ret = kIOReturnSuccess;
+    IOService* client = voodooInputInstance;
+    __atomic_store_n(&voodooInputInstance, NULL, __ATOMIC_SEQ_CST);
+    wait_for_emit();
+    OSSafeReleaseNULL(client);
     
-    input[0] = T4_FEATURE_REPORT_ID;
-    if (read_flag) {
-        input[1] = T4_CMD_REGISTER_READ;
-        input[8] = 0x00;
-    } else {
-        input[1] = T4_CMD_REGISTER_WRITE;
-        input[8] = write_val;
-    }
-    put_unaligned_le32(address, input + 2);
-    input[6] = 1;
-    input[7] = 0;
+    super::handleClose(forClient, options);
+}
+
+#if DEBUG
+void AlpsT4USBEventDriver::check_reference(const alps_frame &frame) {
+    // Emitted into a copy of its own, so frames that went to the ring or nowhere are checked too
+    alps_update_event(reference_event, reference_emitted, frame);
     
-    /* Calculate the checksum */
-    check_sum = t4_calc_check_sum(input, 1, 8);
-    input[9] = (UInt8)check_sum;
-    input[10] = (UInt8)(check_sum >> 8);
-    input[11] = 0;
+    int slot;
+    const char* field = reference.compare(reference_event, slot);
     
-    OSData* input_updated = OSData::withBytes(input, T4_FEATURE_REPORT_LEN);
-    IOBufferMemoryDescriptor* report = IOBufferMemoryDescriptor::withBytes(input_updated->getBytesNoCopy(0, T4_FEATURE_REPORT_LEN), input_updated->getLength(), kIODirectionInOut);
+    if (!field)
+        return;
     
-    input_updated->release();
+    reference_divergences++;
+    if (reference_divergences <= 16 || !(reference_divergences % 1024))
+        IOLog("%s::%s Frame differs from reference model in %s, slot %d (%u so far)\n", getName(), name, field, slot, reference_divergences);
     
-    hid_interface->setReport(report, kIOHIDReportTypeFeature, T4_FEATURE_REPORT_ID);
-
-
-    if (read_flag) {
-        
- 
-        ret = hid_interface->getReport(report, kIOHIDReportTypeFeature, T4_FEATURE_REPORT_ID);
-        
-        report->readBytes(0, &readbuf, T4_FEATURE_REPORT_LEN);
+    reference.resync(reference_event);
+}
+#endif
 
-        if (*(UInt32 *)&readbuf[6] != address) {
-            IOLog("read register address error (%x,%x)\n", *(UInt32 *)&readbuf[6], address);
-            goto exit_readbuf;
-        }
-        
-        if (*(UInt16 *)&readbuf[10] != 1) {
-            IOLog("read register size error (%x)\n", *(UInt16 *)&readbuf[10]);
-            goto exit_readbuf;
-        }
-        
-        check_sum = t4_calc_check_sum(readbuf, 6, 7);
-        if (*(UInt16 *)&readbuf[13] != check_sum) {
-            IOLog("read register checksum error (%x,%x)\n", *(UInt16 *)&readbuf[13], check_sum);
-            goto exit_readbuf;
-        }
-        
-        *read_val = readbuf[12];
+void AlpsT4USBEventDriver::emit_frame(const alps_frame &frame) {
+    // detach_frame_ring() and handleClose() wait for this count to drop before letting go
+    // of the ring or the client, so both stay valid until the end of this function
+    __atomic_add_fetch(&emit_in_flight, 1, __ATOMIC_SEQ_CST);
+    
+    AlpsT4FrameRing* ring = __atomic_load_n(&frame_ring, __ATOMIC_SEQ_CST);
+    IOService* client = __atomic_load_n(&voodooInputInstance, __ATOMIC_SEQ_CST);
+    
+    if (ring) {
+        if (alps_publish_ring_frame(decoder, ring, frame) && client)
+            super::messageClient(kIOMessageAlpsT4FrameRingWakeup, client);
+        recorder.stampEmitted();
+    } else if (client) {
+        ALPS_TRACE(trace, kAlpsTraceEmit, DBG_FUNC_START, frame.valid, frame.button, 0, 0);
+        alps_update_event(inputMessage, emitted, frame);
+        super::messageClient(kIOMessageVoodooInputMessage, client, &inputMessage, sizeof(VoodooInputEvent));
+        recorder.stampEmitted();
+        ALPS_TRACE(trace, kAlpsTraceEmit, DBG_FUNC_END, 0, 0, 0, 0);
     }
     
-    report->release();
-    return ret;
-    
-exit_readbuf:
-exit:
-    report->release();
-    return ret;
-}
-
-
-void AlpsT4USBEventDriver::put_unaligned_le32(uint32_t val, void *p)
-{
-    __put_unaligned_le32(val, (uint8_t*)p);
-}
-
-void AlpsT4USBEventDriver::__put_unaligned_le16(uint16_t val, uint8_t *p)
-{
-    *p++ = val;
-    *p++ = val >> 8;
+    __atomic_sub_fetch(&emit_in_flight, 1, __ATOMIC_RELEASE);
 }
 
-void AlpsT4USBEventDriver::__put_unaligned_le32(uint32_t val, uint8_t *p)
-{
-    __put_unaligned_le16(val >> 16, p + 2);
-    __put_unaligned_le16(val, p);
-}
-
-UInt16 AlpsT4USBEventDriver::get_unaligned_le16(const void *p)
-{
-    return __get_unaligned_le16((const UInt8 *)p);
+void AlpsT4USBEventDriver::wait_for_emit() {
+    while (__atomic_load_n(&emit_in_flight, __ATOMIC_ACQUIRE))
+        IOSleep(1);
 }
 
-UInt16 AlpsT4USBEventDriver::__get_unaligned_le16(const UInt8 *p)
-{
-    return p[0] | p[1] << 8;
-}
-
-bool AlpsT4USBEventDriver::handleOpen(IOService *forClient, IOOptionBits options, void *arg) {
-    if (forClient && forClient->getProperty(VOODOO_INPUT_IDENTIFIER)) {
-        voodooInputInstance = forClient;
-        voodooInputInstance->retain();
-        
-        return true;
+void AlpsT4USBEventDriver::attach_frame_ring() {
+    frame_ring_buffer = IOBufferMemoryDescriptor::withCapacity(sizeof(AlpsT4FrameRing), kIODirectionInOut);
+    if (!frame_ring_buffer)
+        return;
+    
+    AlpsT4FrameRing* ring = (AlpsT4FrameRing*) frame_ring_buffer->getBytesNoCopy();
+    bzero(ring, sizeof(AlpsT4FrameRing));
+    ring->version = ALPS_T4_FRAME_RING_VERSION;
+    ring->capacity = ALPS_T4_FRAME_RING_CAPACITY;
+    
+    // Fall back to per-frame messages unless the client takes the ring
+    if (super::messageClient(kIOMessageAlpsT4FrameRingAttach, voodooInputInstance, frame_ring_buffer) != kIOReturnSuccess) {
+        IOLog("%s::%s Client declined the frame ring\n", getName(), name);
+        OSSafeReleaseNULL(frame_ring_buffer);
+        return;
     }
     
-    return super::handleOpen(forClient, options, arg);
+    __atomic_store_n(&frame_ring, ring, __ATOMIC_SEQ_CST);
 }
 
-void AlpsT4USBEventDriver::handleClose(IOService *forClient, IOOptionBits options) {
-    OSSafeReleaseNULL(voodooInputInstance);
-    super::handleClose(forClient, options);
+void AlpsT4USBEventDriver::detach_frame_ring() {
+    if (!frame_ring_buffer)
+        return;
+    
+    // Reports that already picked up the ring finish with it before the client is told
+    __atomic_store_n(&frame_ring, NULL, __ATOMIC_SEQ_CST);
+    wait_for_emit();
+    
+    super::messageClient(kIOMessageAlpsT4FrameRingDetach, voodooInputInstance, frame_ring_buffer);
+    OSSafeReleaseNULL(frame_ring_buffer);
 }
@@ -17,8 +17,11 @@ for the alps t4 touchpad (https://github.com/torvalds/linux/blob/master/drivers/
 #include <IOKit/IOService.h>
 #include <IOKit/IOBufferMemoryDescriptor.h>
 #include <IOKit/IOCommandGate.h>
+#include <IOKit/IOTimerEventSource.h>
+#include <IOKit/pwr_mgt/RootDomain.h>
 #include <IOKit/hid/IOHIDInterface.h>
 #include <kern/clock.h>
+#include <kern/thread_call.h>
 
 
 #include "IOKit/hid/IOHIDEvent.h"
@@ -33,54 +36,21 @@ for the alps t4 touchpad (https://github.com/torvalds/linux/blob/master/drivers/
 #include "../VoodooInput/VoodooInput/VoodooInputMultitouch/VoodooInputMessages.h"
 
 #include "helpers.hpp"
+#include "AlpsIOHIDTransport.hpp"
+#include "AlpsDevice.hpp"
+#include "AlpsT4FrameRing.h"
+#include "AlpsDecoder.hpp"
+#include "AlpsEventEmitter.hpp"
+#include "AlpsReferenceModel.hpp"
+#include "AlpsT4Trace.hpp"
+#include "AlpsFlightRecorder.hpp"
 
 
-#define HID_PRODUCT_ID_U1_DUAL      0x120B
-#define HID_PRODUCT_ID_T4_BTNLESS   0x120C
-#define HID_PRODUCT_ID_G1           0x120D
-#define HID_PRODUCT_ID_U1           0x1209
-#define HID_PRODUCT_ID_T4_USB       0X1216
-#define ALPS_VENDOR                 0x44e
-
-
-#define T4_INPUT_REPORT_LEN         sizeof(struct t4_input_report)
-#define T4_FEATURE_REPORT_LEN       T4_INPUT_REPORT_LEN
-#define T4_FEATURE_REPORT_ID        0x07
-#define T4_CMD_REGISTER_READ        0x08
-#define T4_CMD_REGISTER_WRITE       0x07
-#define T4_INPUT_REPORT_ID          0x09
-
-#define T4_ADDRESS_BASE                0xC2C0
-#define PRM_SYS_CONFIG_1            (T4_ADDRESS_BASE + 0x0002)
-#define T4_PRM_FEED_CONFIG_1        (T4_ADDRESS_BASE + 0x0004)
-#define T4_PRM_FEED_CONFIG_4        (T4_ADDRESS_BASE + 0x001A)
-#define T4_PRM_ID_CONFIG_3          (T4_ADDRESS_BASE + 0x00B0)
-
-#define T4_FEEDCFG4_ADVANCED_ABS_ENABLE            0x01
-#define T4_I2C_ABS                  0x78
-
-#define T4_COUNT_PER_ELECTRODE      256
-#define MAX_TOUCHES                 5
-
-#define U1_ABSOLUTE_REPORT_ID       0x03 /* Absolute data ReportID */
-#define U1_FEATURE_REPORT_ID        0x05 /* Feature ReportID */
-
-#define U1_FEATURE_REPORT_LEN       0x08 /* Feature Report Length */
-#define U1_FEATURE_REPORT_LEN_ALL   0x0A
-#define U1_CMD_REGISTER_READ        0xD1
-#define U1_CMD_REGISTER_WRITE       0xD2
-
-#define U1_DISABLE_DEV              0x01
-#define U1_TP_ABS_MODE              0x02
-
-#define ADDRESS_U1_DEV_CTRL_1       0x00800040
-#define ADDRESS_U1_DEVICE_TYP       0x00800043
-#define ADDRESS_U1_NUM_SENS_X       0x00800047
-#define ADDRESS_U1_NUM_SENS_Y       0x00800048
-#define ADDRESS_U1_PITCH_SENS_X     0x00800049
-#define ADDRESS_U1_PITCH_SENS_Y     0x0080004A
-#define ADDRESS_U1_RESO_DWN_ABS     0x0080004E
-#define ADDRESS_U1_PAD_BTN          0x00800052
+#define WATCHDOG_INTERVAL_MS        1000
+#define WATCHDOG_FOREIGN_REPORTS    16      /* consecutive non-absolute input reports before recovering */
+#define WATCHDOG_SILENT_TICKS       10      /* idle watchdog ticks before the mode register is checked */
+#define WATCHDOG_BACKOFF_MIN_MS     10
+#define WATCHDOG_BACKOFF_MAX_MS     5000
 
 
 // Message types defined by ApplePS2Keyboard
@@ -92,41 +62,20 @@ enum
     kKeyboardKeyPressTime = iokit_vendor_specific_msg(110)      // notify of timestamp a non-modifier key was pressed (data is uint64_t*)
 };
 
-enum dev_num {
-    U1,
-    T4,
-};
-
-struct alps_dev {
-    UInt8     max_fingers;
-    UInt32    x_active_len_mm;
-    UInt32    y_active_len_mm;
-    UInt32    x_max;
-    UInt32    y_max;
-    UInt32    x_min;
-    UInt32    y_min;
-    UInt32    btn_cnt;
-};
-
-
-struct __attribute__((__packed__)) t4_contact_data {
-    UInt8  palm;
-    UInt8    x_lo;
-    UInt8    x_hi;
-    UInt8    y_lo;
-    UInt8    y_hi;
-};
-
-struct __attribute__((__packed__)) t4_input_report {
-    UInt8  reportID;
-    UInt8  numContacts;
-    struct t4_contact_data contact[5];
-    UInt8  button;
-    UInt8  track[5];
-    UInt8  zx[5], zy[5];
-    UInt8  palmTime[5];
-    UInt8  kilroy;
-    UInt16 timeStamp;
+/* Finger and transducer types for the shared emitter and reference model */
+template <>
+struct alps_event_traits<VoodooInputEvent> {
+    static MT2FingerType finger(int slot) {
+        return (MT2FingerType) (kMT2FingerTypeIndexFinger + (slot % 4));
+    }
+    
+    static MT2FingerType thumb() {
+        return kMT2FingerTypeThumb;
+    }
+    
+    static VoodooInputTransducerType transducer() {
+        return VoodooInputTransducerType::FINGER;
+    }
 };
 
 class AlpsT4USBEventDriver : public IOHIDEventService {
@@ -147,6 +96,7 @@ public:
     void handleClose(IOService *forClient, IOOptionBits options) override;
     
     virtual IOReturn message(UInt32 type, IOService* provider, void* argument) override;
+    IOReturn setProperties(OSObject* properties) override;
     bool didTerminate(IOService* provider, IOOptionBits options, bool* defer) override;
 
     IOReturn setPowerState(unsigned long whichState, IOService* whatDevice) override;
@@ -155,9 +105,6 @@ public:
     IOReturn publishMultitouchInterface();
     const char* getProductName();
     
-    void put_unaligned_le32(uint32_t val, void *p);
-    void __put_unaligned_le16(uint16_t val, uint8_t *p);
-    void __put_unaligned_le32(uint32_t val, uint8_t *p);
     UInt16 get_unaligned_le16(const void *p);
     UInt16 __get_unaligned_le16(const UInt8 *p);
 
@@ -167,27 +114,93 @@ protected:
     const char* name;
     IOHIDInterface* hid_interface;
     
+    /* Register access and init, talking to the device only through hid_transport */
+    AlpsIOHIDTransport hid_transport;
+    AlpsDevice device;
+    
+    /* kdebug probes, off unless TraceEnabled is set */
+    AlpsTrace trace;
+    
+    /* Keeps slow reports and their neighbours, off unless FlightRecorderThreshold is set */
+    AlpsFlightRecorder recorder;
+    
 private:
     void t4_raw_event(AbsoluteTime timestamp, IOMemoryDescriptor *report, IOHIDReportType report_type, UInt32 report_id);
     void u1_raw_event(AbsoluteTime timestamp, IOMemoryDescriptor *report, IOHIDReportType report_type, UInt32 report_id);
+    void u1_sp_raw_event(AbsoluteTime timestamp, IOMemoryDescriptor *report);
     bool ready;
-    uint64_t max_after_typing;
-    uint64_t key_time;
+    
+    /* Decoding, typing suppression and classification state, configured by configure_geometry() */
+    alps_decoder decoder;
+    
     bool awake;
-    dev_num dev_type;
+    /* Handed to registerPowerDriver. Nothing writes it after init(), so the read-only static table
+       it replaced was safe to share too; it is a member only to keep the driver self-contained */
+    IOPMPowerState power_states[kVoodooI2CIOPMNumberPowerStates];
     IOWorkLoop* work_loop;
     IOCommandGate* command_gate;
     
+    /* Watchdog that puts the device back into absolute mode if it falls out of it */
+    IOTimerEventSource* watchdog_timer;
+    UInt32 watchdog_foreign_reports;
+    UInt32 watchdog_silent_ticks;
+    UInt32 watchdog_backoff_ms;
+    bool watchdog_report_seen;
+    
+    /* Hardware init deferred off the matching path, see DeferredDeviceInit */
+    thread_call_t init_thread_call;
+    IOLock* init_lock;
+    bool init_pending;
+    
     VoodooInputEvent inputMessage;
     IOService* voodooInputInstance;
     
-    UInt16 t4_calc_check_sum(UInt8 *buffer, unsigned long offset, unsigned long length);
-    /* Sends a report to the device to instruct it to enter Touchpad mode */
-    void t4_device_init();
-    bool u1_device_init();
+    /* What inputMessage currently holds, so only changed transducer fields get written */
+    alps_emitted emitted;
+    
+    /* Shared frame ring, only when the client asked for one */
+    IOBufferMemoryDescriptor* frame_ring_buffer;
+    AlpsT4FrameRing* frame_ring;
+    
+    /* Reports between picking up frame_ring/voodooInputInstance and being done with them */
+    UInt32 emit_in_flight;
+    
+    void attach_frame_ring();
+    void detach_frame_ring();
+    void emit_frame(const alps_frame &frame);
+    void wait_for_emit();
+    
+    /* Debug builds replay every report through the original decoder, configured alongside
+       decoder, and compare it with reference_event, which gets every frame whether or not
+       inputMessage does */
+#if DEBUG
+    AlpsReferenceModel<VoodooInputEvent> reference;
+    VoodooInputEvent reference_event;
+    alps_emitted reference_emitted;
+    UInt32 reference_divergences;
+    
+    void check_reference(const alps_frame &frame);
+#endif
+    
+    void configure_geometry(UInt32 physical_max_x, UInt32 physical_max_y);
+    void configure_transform();
+    void configure_palm_zones();
+    void configure_classifier();
+    
+    /* Puts the device in absolute mode and publishes the geometry it reports */
+    void device_init();
+    
+    /* Register transactions, run on command_gate so init, wake and the watchdog never interleave */
+    IOReturn gatedDeviceInit(void* arg0, void* arg1, void* arg2, void* arg3);
+    IOReturn gatedWakeDevice(void* arg0, void* arg1, void* arg2, void* arg3);
+    IOReturn gatedRestoreAbsoluteMode(void* arg0, void* arg1, void* arg2, void* arg3);
+    
+    void set_default_geometry();
+    void wait_for_device_init();
+    static void deferredDeviceInit(thread_call_param_t param0, thread_call_param_t param1);
     
-    IOReturn u1_read_write_register(UInt32 address, UInt8 *read_val, UInt8 write_val, bool read_flag);
-    IOReturn t4_read_write_register(UInt32 address, UInt8 *read_val, UInt8 write_val, bool read_flag);
+    void watchdogTimeout(IOTimerEventSource* sender);
+    IOReturn restore_absolute_mode();
     
 };
 
@@ -0,0 +1,98 @@
+//
+//  AlpsHidrawTransport.cpp
+//  AlpsT4USB host build
+//
+
+#include "AlpsHidrawTransport.hpp"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+
+#include <fstream>
+
+static IOReturn hidraw_error(int error) {
+    switch (error) {
+        case ETIMEDOUT:
+            return kIOReturnTimeout;
+        case ENODEV:
+        case EBADF:
+            return kIOReturnNotReady;
+        case EINVAL:
+            return kIOReturnBadArgument;
+        default:
+            return kIOReturnIOError;
+    }
+}
+
+bool AlpsHidrawTransport::open(const char *path) {
+    close();
+    fd = ::open(path, O_RDWR | O_CLOEXEC);
+    return fd >= 0;
+}
+
+void AlpsHidrawTransport::close() {
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+}
+
+std::string AlpsHidrawTransport::findByUniq(const char *uniq) {
+    std::string wanted = std::string("HID_UNIQ=") + uniq;
+    std::string found;
+    
+    DIR *dir = opendir("/sys/class/hidraw");
+    if (!dir)
+        return found;
+    
+    while (struct dirent *entry = readdir(dir)) {
+        if (strncmp(entry->d_name, "hidraw", 6) != 0)
+            continue;
+        
+        std::ifstream uevent(std::string("/sys/class/hidraw/") + entry->d_name + "/device/uevent");
+        std::string line;
+        while (std::getline(uevent, line)) {
+            if (line == wanted) {
+                found = std::string("/dev/") + entry->d_name;
+                break;
+            }
+        }
+        if (!found.empty())
+            break;
+    }
+    
+    closedir(dir);
+    return found;
+}
+
+int AlpsHidrawTransport::readInputReport(UInt8 *report, UInt32 length, int timeout_ms) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready <= 0)
+        return ready;
+    
+    ssize_t count = read(fd, report, length);
+    return count < 0 ? -1 : (int) count;
+}
+
+IOReturn AlpsHidrawTransport::setFeatureReport(const UInt8 *report, UInt32 length) {
+    // hidraw does not write to the buffer, the ioctl is just not declared const
+    if (ioctl(fd, HIDIOCSFEATURE(length), const_cast<UInt8 *>(report)) < 0)
+        return hidraw_error(errno);
+    
+    return kIOReturnSuccess;
+}
+
+IOReturn AlpsHidrawTransport::getFeatureReport(UInt8 *report, UInt32 length) {
+    // report[0] selects the report, the reply comes back with its ID in report[0]
+    if (ioctl(fd, HIDIOCGFEATURE(length), report) < 0)
+        return hidraw_error(errno);
+    
+    return kIOReturnSuccess;
+}
@@ -0,0 +1,37 @@
+//
+//  AlpsHidrawTransport.hpp
+//  AlpsT4USB host build
+//
+//  AlpsHIDTransport over a Linux /dev/hidrawN node, the host counterpart of
+//  AlpsIOHIDTransport. Feature reports go through HIDIOCSFEATURE/HIDIOCGFEATURE.
+//
+
+#ifndef AlpsHidrawTransport_hpp
+#define AlpsHidrawTransport_hpp
+
+#include <string>
+
+#include "AlpsHIDTransport.hpp"
+
+class AlpsHidrawTransport : public AlpsHIDTransport {
+public:
+    AlpsHidrawTransport() : fd(-1) {}
+    ~AlpsHidrawTransport() override { close(); }
+    
+    bool open(const char *path);
+    void close();
+    
+    /* The /dev/hidrawN node of the device with this HID_UNIQ, empty while there is none */
+    static std::string findByUniq(const char *uniq);
+    
+    /* Waits up to timeout_ms for an input report, returns its length, 0 on timeout and -1 on error */
+    int readInputReport(UInt8 *report, UInt32 length, int timeout_ms);
+    
+    IOReturn setFeatureReport(const UInt8 *report, UInt32 length) override;
+    IOReturn getFeatureReport(UInt8 *report, UInt32 length) override;
+    
+private:
+    int fd;
+};
+
+#endif /* AlpsHidrawTransport_hpp */
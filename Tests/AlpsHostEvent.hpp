@@ -0,0 +1,72 @@
+//
+//  AlpsHostEvent.hpp
+//  AlpsT4USB host build
+//
+//  A stand-in for VoodooInputEvent with the fields the emitter and the reference model
+//  touch, so both run on the host without the VoodooInput headers.
+//
+
+#ifndef AlpsHostEvent_hpp
+#define AlpsHostEvent_hpp
+
+#include "AlpsEventEmitter.hpp"
+
+#define ALPS_HOST_MAX_TRANSDUCERS   10
+
+enum AlpsHostFingerType {
+    kAlpsHostFingerUndefined,
+    kAlpsHostFingerThumb,
+    kAlpsHostFingerIndex,
+    kAlpsHostFingerMiddle,
+    kAlpsHostFingerRing,
+    kAlpsHostFingerLittle,
+};
+
+enum AlpsHostTransducerType {
+    kAlpsHostStylus,
+    kAlpsHostFinger,
+};
+
+struct AlpsHostCoordinates {
+    UInt32 x;
+    UInt32 y;
+    UInt8 pressure;
+    UInt8 width;
+};
+
+struct AlpsHostTransducer {
+    AbsoluteTime timestamp;
+    UInt32 secondaryId;
+    AlpsHostFingerType fingerType;
+    AlpsHostTransducerType type;
+    bool isValid;
+    bool isPhysicalButtonDown;
+    bool isTransducerActive;
+    bool supportsPressure;
+    AlpsHostCoordinates currentCoordinates;
+    AlpsHostCoordinates previousCoordinates;
+    UInt32 maxPressure;
+};
+
+struct AlpsHostEvent {
+    UInt8 contact_count;
+    AbsoluteTime timestamp;
+    AlpsHostTransducer transducers[ALPS_HOST_MAX_TRANSDUCERS];
+};
+
+template <>
+struct alps_event_traits<AlpsHostEvent> {
+    static AlpsHostFingerType finger(int slot) {
+        return (AlpsHostFingerType) (kAlpsHostFingerIndex + (slot % 4));
+    }
+    
+    static AlpsHostFingerType thumb() {
+        return kAlpsHostFingerThumb;
+    }
+    
+    static AlpsHostTransducerType transducer() {
+        return kAlpsHostFinger;
+    }
+};
+
+#endif /* AlpsHostEvent_hpp */
@@ -0,0 +1,176 @@
+//
+//  AlpsSimulatedDevice.cpp
+//  AlpsT4USB host build
+//
+
+#include "AlpsSimulatedDevice.hpp"
+
+#include <string.h>
+
+/* Power-on register values, chosen so every geometry computation has something to chew on */
+#define SIM_T4_ID_CONFIG_3          0x21    /* 17 x 14 sensor lines */
+#define SIM_T4_SYS_CONFIG_1         0x40
+#define SIM_U1_DEV_CTRL_1           U1_DISABLE_DEV
+#define SIM_U1_NUM_SENS_X           23
+#define SIM_U1_NUM_SENS_Y           13
+#define SIM_U1_PITCH_SENS           48
+#define SIM_U1_RESO_DWN_ABS         0x40
+#define SIM_U1_PAD_BTN              0x11
+
+static const UInt8 report_descriptor[] = {
+    0x06, 0x00, 0xFF,           // Usage Page (Vendor 0xFF00)
+    0x09, 0x01,                 // Usage (0x01)
+    0xA1, 0x01,                 // Collection (Application)
+    0x15, 0x00,                 //   Logical Minimum (0)
+    0x26, 0xFF, 0x00,           //   Logical Maximum (255)
+    0x75, 0x08,                 //   Report Size (8)
+    0x85, T4_INPUT_REPORT_ID,   //   Report ID, T4 absolute input
+    0x95, 0x32,                 //   Report Count (50)
+    0x09, 0x01,                 //   Usage (0x01)
+    0x81, 0x02,                 //   Input (Data, Var, Abs)
+    0x85, U1_ABSOLUTE_REPORT_ID, // Report ID, U1 absolute input
+    0x95, 0x1B,                 //   Report Count (27)
+    0x09, 0x01,                 //   Usage (0x01)
+    0x81, 0x02,                 //   Input (Data, Var, Abs)
+    0x85, U1_SP_ABSOLUTE_REPORT_ID, // Report ID, U1 pointing stick
+    0x95, 0x05,                 //   Report Count (5)
+    0x09, 0x01,                 //   Usage (0x01)
+    0x81, 0x02,                 //   Input (Data, Var, Abs)
+    0x85, T4_FEATURE_REPORT_ID, //   Report ID, T4 register access
+    0x95, 0x32,                 //   Report Count (50)
+    0x09, 0x02,                 //   Usage (0x02)
+    0xB1, 0x02,                 //   Feature (Data, Var, Abs)
+    0x85, U1_FEATURE_REPORT_ID, //   Report ID, U1 register access
+    0x95, 0x07,                 //   Report Count (7)
+    0x09, 0x02,                 //   Usage (0x02)
+    0xB1, 0x02,                 //   Feature (Data, Var, Abs)
+    0xC0                        // End Collection
+};
+
+AlpsSimulatedDevice::AlpsSimulatedDevice(UInt32 product_id) : product(product_id), reply(), reply_length(0),
+    transfer_count(0), fail_after(-1), corrupt_reply(false) {
+    if (isT4()) {
+        registers[T4_PRM_ID_CONFIG_3] = SIM_T4_ID_CONFIG_3;
+        registers[PRM_SYS_CONFIG_1] = SIM_T4_SYS_CONFIG_1;
+    } else {
+        registers[ADDRESS_U1_DEV_CTRL_1] = SIM_U1_DEV_CTRL_1;
+        registers[ADDRESS_U1_DEVICE_TYP] = product_id == HID_PRODUCT_ID_U1_DUAL ? U1_DEVTYPE_SP_SUPPORT : 0;
+        registers[ADDRESS_U1_NUM_SENS_X] = SIM_U1_NUM_SENS_X;
+        registers[ADDRESS_U1_NUM_SENS_Y] = SIM_U1_NUM_SENS_Y;
+        registers[ADDRESS_U1_PITCH_SENS_X] = SIM_U1_PITCH_SENS;
+        registers[ADDRESS_U1_PITCH_SENS_Y] = SIM_U1_PITCH_SENS;
+        registers[ADDRESS_U1_RESO_DWN_ABS] = SIM_U1_RESO_DWN_ABS;
+        registers[ADDRESS_U1_PAD_BTN] = SIM_U1_PAD_BTN;
+    }
+}
+
+bool AlpsSimulatedDevice::isT4() const {
+    return product != HID_PRODUCT_ID_U1 && product != HID_PRODUCT_ID_U1_DUAL;
+}
+
+bool AlpsSimulatedDevice::transfer() {
+    transfer_count++;
+    
+    if (fail_after < 0)
+        return true;
+    
+    return fail_after-- != 0;
+}
+
+UInt8 AlpsSimulatedDevice::reg(UInt32 address) const {
+    std::map<UInt32, UInt8>::const_iterator it = registers.find(address);
+    return it == registers.end() ? 0 : it->second;
+}
+
+bool AlpsSimulatedDevice::inAbsoluteMode() const {
+    if (isT4())
+        return reg(T4_PRM_FEED_CONFIG_1) == T4_I2C_ABS;
+    
+    return reg(ADDRESS_U1_DEV_CTRL_1) & U1_TP_ABS_MODE;
+}
+
+bool AlpsSimulatedDevice::setFeature(const UInt8 *report, UInt32 length) {
+    if (!transfer())
+        return false;
+    
+    if (isT4()) {
+        if (length < 11 || report[0] != T4_FEATURE_REPORT_ID)
+            return false;
+        if (alps_get_le16(report + 9) != t4_check_sum(report + 1, 8) || alps_get_le16(report + 6) != 1)
+            return false;
+        
+        UInt32 address = alps_get_le32(report + 2);
+        
+        if (report[1] == T4_CMD_REGISTER_WRITE) {
+            registers[address] = report[8];
+            return true;
+        }
+        if (report[1] != T4_CMD_REGISTER_READ)
+            return false;
+        
+        // le32 address, le16 size, value and le16 checksum of those, from byte 6
+        memset(reply, 0, sizeof(reply));
+        reply[0] = T4_FEATURE_REPORT_ID;
+        alps_put_le32(address, reply + 6);
+        reply[10] = 1;
+        reply[12] = reg(address);
+        UInt16 check_sum = t4_check_sum(reply + 6, 7);
+        if (corrupt_reply)
+            check_sum ^= 0x0101;
+        corrupt_reply = false;
+        reply[13] = (UInt8) check_sum;
+        reply[14] = (UInt8) (check_sum >> 8);
+        reply_length = T4_FEATURE_REPORT_LEN;
+        return true;
+    }
+    
+    if (length < U1_FEATURE_REPORT_LEN || report[0] != U1_FEATURE_REPORT_ID)
+        return false;
+    
+    UInt8 check_sum = U1_FEATURE_REPORT_LEN_ALL;
+    for (int i = 0; i < U1_FEATURE_REPORT_LEN - 1; i++)
+        check_sum += report[i];
+    if (check_sum != report[7])
+        return false;
+    
+    UInt32 address = alps_get_le32(report + 2);
+    
+    if (report[1] == U1_CMD_REGISTER_WRITE) {
+        registers[address] = report[6];
+        return true;
+    }
+    if (report[1] != U1_CMD_REGISTER_READ)
+        return false;
+    
+    // The reply is the request with the value filled in
+    memcpy(reply, report, U1_FEATURE_REPORT_LEN);
+    reply[6] = reg(address);
+    reply_length = U1_FEATURE_REPORT_LEN;
+    return true;
+}
+
+UInt32 AlpsSimulatedDevice::getFeature(UInt8 report_id, UInt8 *buffer, UInt32 length) {
+    if (!transfer())
+        return 0;
+    
+    UInt8 expected = isT4() ? T4_FEATURE_REPORT_ID : U1_FEATURE_REPORT_ID;
+    if (report_id != expected || !reply_length)
+        return 0;
+    
+    UInt32 count = length < reply_length ? length : reply_length;
+    memcpy(buffer, reply, count);
+    return count;
+}
+
+const UInt8 *AlpsSimulatedDevice::reportDescriptor(UInt32 *length) {
+    *length = sizeof(report_descriptor);
+    return report_descriptor;
+}
+
+IOReturn AlpsSimulatedTransport::setFeatureReport(const UInt8 *report, UInt32 length) {
+    return device.setFeature(report, length) ? kIOReturnSuccess : kIOReturnIOError;
+}
+
+IOReturn AlpsSimulatedTransport::getFeatureReport(UInt8 *report, UInt32 length) {
+    return device.getFeature(report[0], report, length) ? kIOReturnSuccess : kIOReturnIOError;
+}
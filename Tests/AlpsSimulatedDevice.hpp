@@ -0,0 +1,71 @@
+//
+//  AlpsSimulatedDevice.hpp
+//  AlpsT4USB host build
+//
+//  The register side of a T4 or U1 as it looks from the feature reports: register
+//  writes land in a register file, reads are answered with the reply frame the device
+//  would send. The same object answers uhid requests and the in-process transport.
+//
+
+#ifndef AlpsSimulatedDevice_hpp
+#define AlpsSimulatedDevice_hpp
+
+#include <map>
+
+#include "AlpsDevice.hpp"
+
+class AlpsSimulatedDevice {
+public:
+    explicit AlpsSimulatedDevice(UInt32 product_id);
+    
+    UInt32 productID() const { return product; }
+    bool isT4() const;
+    
+    /* A SET_REPORT of a feature report, report[0] is the ID; false fails the transfer */
+    bool setFeature(const UInt8 *report, UInt32 length);
+    
+    /* Answers a GET_REPORT into reply, returns the reply length or 0 to fail the transfer */
+    UInt32 getFeature(UInt8 report_id, UInt8 *reply, UInt32 length);
+    
+    UInt8 reg(UInt32 address) const;
+    void setReg(UInt32 address, UInt8 value) { registers[address] = value; }
+    
+    /* What the driver checks to decide whether the mode needs restoring */
+    bool inAbsoluteMode() const;
+    
+    /* Fails the transfer this many transfers from now, a negative count never fails */
+    void failTransfer(int after) { fail_after = after; }
+    
+    /* Garbles the checksum of the next T4 read reply */
+    void corruptNextReply() { corrupt_reply = true; }
+    
+    unsigned transfers() const { return transfer_count; }
+    
+    /* Vendor-page report descriptor declaring the report IDs the device uses */
+    static const UInt8 *reportDescriptor(UInt32 *length);
+    
+private:
+    bool transfer();
+    
+    UInt32 product;
+    std::map<UInt32, UInt8> registers;
+    UInt8 reply[T4_FEATURE_REPORT_LEN];
+    UInt32 reply_length;
+    unsigned transfer_count;
+    int fail_after;
+    bool corrupt_reply;
+};
+
+/* Hands feature reports straight to an AlpsSimulatedDevice in the same process */
+class AlpsSimulatedTransport : public AlpsHIDTransport {
+public:
+    explicit AlpsSimulatedTransport(AlpsSimulatedDevice &device) : device(device) {}
+    
+    IOReturn setFeatureReport(const UInt8 *report, UInt32 length) override;
+    IOReturn getFeatureReport(UInt8 *report, UInt32 length) override;
+    
+private:
+    AlpsSimulatedDevice &device;
+};
+
+#endif /* AlpsSimulatedDevice_hpp */
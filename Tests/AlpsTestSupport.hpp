@@ -0,0 +1,72 @@
+//
+//  AlpsTestSupport.hpp
+//  AlpsT4USB host build
+//
+//  Just enough of a test harness for the host tests: CHECK reports the failing
+//  expression and keeps going, alps_test_result() turns the tally into an exit code.
+//  alps_trace_log collects what the trace probes record.
+//
+
+#ifndef AlpsTestSupport_hpp
+#define AlpsTestSupport_hpp
+
+#include <stdio.h>
+#include <vector>
+
+#include "AlpsT4Trace.hpp"
+
+/* ctest treats this exit code as skipped, see SKIP_RETURN_CODE in CMakeLists.txt */
+#define ALPS_TEST_SKIPPED   77
+
+static int alps_test_failures;
+
+#define CHECK(expr) do {                                                            \
+    if (!(expr)) {                                                                  \
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #expr);    \
+        alps_test_failures++;                                                       \
+    }                                                                               \
+} while (0)
+
+static inline int alps_test_result(const char *name) {
+    if (alps_test_failures)
+        fprintf(stderr, "%s: %d check(s) failed\n", name, alps_test_failures);
+    else
+        printf("%s: passed\n", name);
+    
+    return alps_test_failures ? 1 : 0;
+}
+
+/* One kdebug record as the kernel would have taken it, tag is the last argument */
+struct alps_trace_record {
+    UInt32 point;
+    UInt32 func;
+    uintptr_t arg[4];
+    uintptr_t tag;
+};
+
+/* Hook up with trace.setSink(alps_trace_log::sink, &log) */
+struct alps_trace_log {
+    std::vector<alps_trace_record> records;
+    
+    static void sink(void* context, UInt32 code, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t arg4, uintptr_t arg5) {
+        alps_trace_record record = {(code & 0xFFFC) >> 2, code & 0x3, {arg1, arg2, arg3, arg4}, arg5};
+        static_cast<alps_trace_log *>(context)->records.push_back(record);
+    }
+    
+    /* How many records of point/func were taken, and whether all of them carried the tag */
+    size_t count(UInt32 point, UInt32 func, uintptr_t tag, bool *tagged) const {
+        size_t found = 0;
+        
+        for (size_t i = 0; i < records.size(); i++) {
+            if (records[i].point != point || records[i].func != func)
+                continue;
+            found++;
+            if (records[i].tag != tag)
+                *tagged = false;
+        }
+        
+        return found;
+    }
+};
+
+#endif /* AlpsTestSupport_hpp */
@@ -0,0 +1,142 @@
+//
+//  AlpsUHIDDevice.cpp
+//  AlpsT4USB host build
+//
+
+#include "AlpsUHIDDevice.hpp"
+#include "AlpsHidrawTransport.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/input.h>
+#include <linux/uhid.h>
+
+#include <chrono>
+
+static bool uhid_write(int fd, const struct uhid_event &event) {
+    return write(fd, &event, sizeof(event)) == (ssize_t) sizeof(event);
+}
+
+bool AlpsUHIDDevice::create(AlpsSimulatedDevice *device, const char *uniq) {
+    fd = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    
+    sim = device;
+    this->uniq = uniq;
+    
+    UInt32 descriptor_length;
+    const UInt8 *descriptor = AlpsSimulatedDevice::reportDescriptor(&descriptor_length);
+    
+    // BUS_VIRTUAL keeps the kernel's own hid-alps, which matches the USB and I2C IDs, off the device
+    struct uhid_event event;
+    memset(&event, 0, sizeof(event));
+    event.type = UHID_CREATE2;
+    strncpy((char *) event.u.create2.name, "Alps simulated touchpad", sizeof(event.u.create2.name) - 1);
+    strncpy((char *) event.u.create2.uniq, uniq, sizeof(event.u.create2.uniq) - 1);
+    event.u.create2.rd_size = descriptor_length;
+    event.u.create2.bus = BUS_VIRTUAL;
+    event.u.create2.vendor = ALPS_VENDOR;
+    event.u.create2.product = device->productID();
+    memcpy(event.u.create2.rd_data, descriptor, descriptor_length);
+    
+    if (!uhid_write(fd, event)) {
+        int error = errno;
+        close(fd);
+        fd = -1;
+        errno = error;
+        return false;
+    }
+    
+    stopping = false;
+    thread = std::thread(&AlpsUHIDDevice::run, this);
+    return true;
+}
+
+void AlpsUHIDDevice::destroy() {
+    if (fd < 0)
+        return;
+    
+    struct uhid_event event;
+    memset(&event, 0, sizeof(event));
+    event.type = UHID_DESTROY;
+    uhid_write(fd, event);
+    
+    stopping = true;
+    if (thread.joinable())
+        thread.join();
+    
+    close(fd);
+    fd = -1;
+}
+
+bool AlpsUHIDDevice::sendInput(const UInt8 *report, UInt32 length) {
+    struct uhid_event event;
+    memset(&event, 0, sizeof(event));
+    event.type = UHID_INPUT2;
+    event.u.input2.size = length;
+    memcpy(event.u.input2.data, report, length);
+    
+    return uhid_write(fd, event);
+}
+
+std::string AlpsUHIDDevice::waitForHidraw(int timeout_ms) {
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    
+    // The node appears once the kernel has parsed the descriptor and hid-generic bound
+    do {
+        std::string path = AlpsHidrawTransport::findByUniq(uniq.c_str());
+        if (!path.empty() && access(path.c_str(), R_OK | W_OK) == 0)
+            return path;
+        usleep(10000);
+    } while (std::chrono::steady_clock::now() < deadline);
+    
+    return std::string();
+}
+
+void AlpsUHIDDevice::run() {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    
+    while (!stopping) {
+        if (poll(&pfd, 1, 100) <= 0)
+            continue;
+        
+        struct uhid_event event;
+        if (read(fd, &event, sizeof(event)) <= 0)
+            continue;
+        
+        struct uhid_event reply;
+        memset(&reply, 0, sizeof(reply));
+        
+        switch (event.type) {
+            case UHID_GET_REPORT: {
+                UInt32 size = 0;
+                if (event.u.get_report.rtype == UHID_FEATURE_REPORT)
+                    size = sim->getFeature(event.u.get_report.rnum, reply.u.get_report_reply.data, UHID_DATA_MAX);
+                
+                reply.type = UHID_GET_REPORT_REPLY;
+                reply.u.get_report_reply.id = event.u.get_report.id;
+                reply.u.get_report_reply.err = size ? 0 : EIO;
+                reply.u.get_report_reply.size = size;
+                uhid_write(fd, reply);
+                break;
+            }
+            case UHID_SET_REPORT: {
+                bool ok = event.u.set_report.rtype == UHID_FEATURE_REPORT &&
+                    sim->setFeature(event.u.set_report.data, event.u.set_report.size);
+                
+                reply.type = UHID_SET_REPORT_REPLY;
+                reply.u.set_report_reply.id = event.u.set_report.id;
+                reply.u.set_report_reply.err = ok ? 0 : EIO;
+                uhid_write(fd, reply);
+                break;
+            }
+            default:
+                // START, STOP, OPEN, CLOSE and OUTPUT need no answer
+                break;
+        }
+    }
+}
@@ -0,0 +1,44 @@
+//
+//  AlpsUHIDDevice.hpp
+//  AlpsT4USB host build
+//
+//  Puts an AlpsSimulatedDevice on the kernel's HID bus through /dev/uhid, so the host
+//  code reaches it through a real hidraw node. Feature report requests are answered on
+//  a thread of its own, the way the device answers them while the host waits.
+//
+
+#ifndef AlpsUHIDDevice_hpp
+#define AlpsUHIDDevice_hpp
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "AlpsSimulatedDevice.hpp"
+
+class AlpsUHIDDevice {
+public:
+    AlpsUHIDDevice() : fd(-1), sim(NULL), stopping(false) {}
+    ~AlpsUHIDDevice() { destroy(); }
+    
+    /* False with errno set when /dev/uhid cannot be opened or the device not created */
+    bool create(AlpsSimulatedDevice *device, const char *uniq);
+    void destroy();
+    
+    /* Sends an input report, report[0] is the report ID */
+    bool sendInput(const UInt8 *report, UInt32 length);
+    
+    /* Waits up to timeout_ms for the hidraw node to show up, empty if it did not */
+    std::string waitForHidraw(int timeout_ms);
+    
+private:
+    void run();
+    
+    int fd;
+    AlpsSimulatedDevice *sim;
+    std::string uniq;
+    std::thread thread;
+    std::atomic<bool> stopping;
+};
+
+#endif /* AlpsUHIDDevice_hpp */
@@ -0,0 +1,277 @@
+//
+//  DecoderTest.cpp
+//  AlpsT4USB host build
+//
+//  Hand-written cases for the report path with the expected values spelled out, next to
+//  FuzzReports which only compares it with the reference model.
+//
+
+#include <string.h>
+
+#include "AlpsDecoder.hpp"
+#include "AlpsTestSupport.hpp"
+
+#define MS                      1000000ull      /* host absolute time is in nanoseconds */
+#define QUIET_TIME              (500 * MS)
+#define START                   (1000 * MS)
+
+static const alps_dev u1_geometry = {5, 0, 0, 5376, 3072, 1, 1, 1};
+static const alps_dev t4_btnless_geometry = {5, 0, 0, 17 * 256, 14 * 256, 256, 256, 0};
+
+/* A U1 decoder with the whole pad palm-prone, as the default configuration has it */
+static void make_decoder(alps_decoder &decoder) {
+    memset(&decoder, 0, sizeof(decoder));
+    decoder.max_after_typing = QUIET_TIME;
+    
+    alps_configure_transform(decoder, U1, u1_geometry, 0, false, false);
+    alps_configure_palm_zones(decoder, 0, 0, 0, 0);
+    alps_configure_classifier(decoder, THUMB_ZONE_DEFAULT_PERCENT, 0, RESTING_TRAVEL_DEFAULT);
+}
+
+struct touch {
+    bool down;
+    UInt32 x;
+    UInt32 y;
+};
+
+/* Decodes a U1 report with touches in slots 0 and up */
+static alps_frame u1_touches(alps_decoder &decoder, AbsoluteTime timestamp, bool button, const touch *touches, int count) {
+    UInt8 data[U1_ABSOLUTE_REPORT_LEN] = {U1_ABSOLUTE_REPORT_ID, button};
+    alps_frame frame;
+    
+    for (int i = 0; i < count; i++) {
+        UInt8 *contact = &data[i * 5];
+        if (!touches[i].down)
+            continue;
+        contact[3] = (UInt8) touches[i].x;
+        contact[4] = (UInt8) (touches[i].x >> 8);
+        contact[5] = (UInt8) touches[i].y;
+        contact[6] = (UInt8) (touches[i].y >> 8);
+        contact[7] = 0x30;
+    }
+    
+    alps_u1_decode(decoder, data, timestamp, frame);
+    alps_classify_contacts(decoder, frame);
+    
+    return frame;
+}
+
+/* Decodes a U1 report with contact 0 at x, y, or nothing touching when down is false */
+static alps_frame u1_frame(alps_decoder &decoder, AbsoluteTime timestamp, bool down, UInt32 x = 0, UInt32 y = 0) {
+    touch touches[1] = {{down, x, y}};
+    return u1_touches(decoder, timestamp, false, touches, 1);
+}
+
+/* Decodes a T4 report with contact 0 at raw x, y */
+static alps_frame t4_frame(alps_decoder &decoder, AbsoluteTime timestamp, UInt32 x, UInt32 y) {
+    t4_input_report report = {};
+    alps_frame frame;
+    
+    report.reportID = T4_INPUT_REPORT_ID;
+    report.contact[0] = {0x3E, (UInt8) x, (UInt8) (x >> 8), (UInt8) y, (UInt8) (y >> 8)};
+    
+    alps_t4_decode(decoder, report, timestamp, frame);
+    alps_classify_contacts(decoder, frame);
+    
+    return frame;
+}
+
+/* T4 y is flipped about the device bounds, on pads taller than the 12-line default too */
+static void test_t4_native_flip() {
+    alps_decoder decoder;
+    make_decoder(decoder);
+    alps_configure_transform(decoder, T4, t4_btnless_geometry, 0, false, false);
+    
+    CHECK(decoder.logical_min_y == 256 && decoder.logical_max_y == 3584);
+    
+    alps_frame frame = t4_frame(decoder, START, 300, 3584);
+    CHECK(frame.valid == BIT(0));
+    CHECK(frame.x[0] == 300 && frame.y[0] == 256);
+    
+    frame = t4_frame(decoder, START, 4352, 256);
+    CHECK(frame.x[0] == 4352 && frame.y[0] == 3584);
+    
+    frame = t4_frame(decoder, START, 2000, 3400);
+    CHECK(frame.y[0] == 256 + 3584 - 3400);
+    
+    // Out of range reports are clamped instead of wrapping around
+    frame = t4_frame(decoder, START, 0, 4000);
+    CHECK(frame.x[0] == 256 && frame.y[0] == 256);
+    
+    frame = t4_frame(decoder, START, 65535, 0);
+    CHECK(frame.x[0] == 4352 && frame.y[0] == 3584);
+}
+
+/* A finger that lands during the quiet time is dropped only until the quiet time is over */
+static void test_typing_quiet_time_ends() {
+    alps_decoder decoder;
+    make_decoder(decoder);
+    
+    decoder.key_time = START;
+    
+    CHECK(u1_frame(decoder, START + 100 * MS, true, 2000, 1500).valid == 0);
+    CHECK(u1_frame(decoder, START + 499 * MS, true, 2000, 1500).valid == 0);
+    
+    alps_frame frame = u1_frame(decoder, START + 500 * MS, true, 2000, 1500);
+    CHECK(frame.valid == BIT(0));
+    CHECK(frame.contact_count == 1);
+    CHECK(frame.x[0] == 2000 && frame.y[0] == 1500);
+    
+    // Tracking from here on, another key press does not take it away mid-touch
+    decoder.key_time = START + 600 * MS;
+    CHECK(u1_frame(decoder, START + 610 * MS, true, 2010, 1500).valid == BIT(0));
+    
+    CHECK(u1_frame(decoder, START + 620 * MS, false).valid == 0);
+    CHECK(u1_frame(decoder, START + 630 * MS, true, 2000, 1500).valid == 0);
+}
+
+/* A suppressed contact that moves further than a resting palm would is a finger */
+static void test_typing_travel() {
+    alps_decoder decoder;
+    make_decoder(decoder);
+    
+    decoder.key_time = START;
+    
+    CHECK(u1_frame(decoder, START + 10 * MS, true, 2000, 1500).valid == 0);
+    CHECK(u1_frame(decoder, START + 20 * MS, true, 2000 + PALM_RELEASE_TRAVEL / 2, 1500 - PALM_RELEASE_TRAVEL / 2).valid == 0);
+    CHECK(u1_frame(decoder, START + 30 * MS, true, 2000 + PALM_RELEASE_TRAVEL / 2, 1500 + PALM_RELEASE_TRAVEL / 2 + 1).valid == BIT(0));
+}
+
+/* Outside the palm zones nothing is suppressed, and a finger down before typing keeps tracking */
+static void test_typing_palm_zones() {
+    alps_decoder decoder;
+    make_decoder(decoder);
+    alps_configure_palm_zones(decoder, 10, 10, 0, 20);
+    
+    decoder.key_time = START;
+    
+    CHECK(u1_frame(decoder, START + 10 * MS, true, 2000, 1500).valid == BIT(0));
+    CHECK(u1_frame(decoder, START + 20 * MS, true, 2000, 2900).valid == BIT(0));
+    CHECK(u1_frame(decoder, START + 30 * MS, false).valid == 0);
+    CHECK(u1_frame(decoder, START + 40 * MS, true, 2000, 2900).valid == 0);
+}
+
+/* Each corner of the pad, raw and then where every clockwise quarter turn puts it */
+static void test_rotation_corners() {
+    static const UInt32 raw[4][2] = {{1, 1}, {5376, 1}, {1, 3072}, {5376, 3072}};
+    static const UInt32 turned[4][4][2] = {
+        {{1, 1}, {5376, 1}, {1, 3072}, {5376, 3072}},
+        {{3072, 1}, {3072, 5376}, {1, 1}, {1, 5376}},
+        {{5376, 3072}, {1, 3072}, {5376, 1}, {1, 1}},
+        {{1, 5376}, {1, 1}, {3072, 5376}, {3072, 1}},
+    };
+    
+    for (UInt32 turns = 0; turns < 4; turns++) {
+        alps_decoder decoder;
+        make_decoder(decoder);
+        alps_configure_transform(decoder, U1, u1_geometry, turns, false, false);
+        
+        CHECK(decoder.logical_min_x == 1 && decoder.logical_min_y == 1);
+        CHECK(decoder.logical_max_x == (turns & 1 ? 3072u : 5376u));
+        CHECK(decoder.logical_max_y == (turns & 1 ? 5376u : 3072u));
+        
+        for (int corner = 0; corner < 4; corner++) {
+            alps_frame frame = u1_frame(decoder, START + corner * MS, true, raw[corner][0], raw[corner][1]);
+            CHECK(frame.x[0] == turned[turns][corner][0] && frame.y[0] == turned[turns][corner][1]);
+            u1_frame(decoder, START + corner * MS, false);
+        }
+    }
+    
+    // Mirrored first, then turned
+    alps_decoder decoder;
+    make_decoder(decoder);
+    alps_configure_transform(decoder, U1, u1_geometry, 1, true, false);
+    alps_frame frame = u1_frame(decoder, START, true, 1, 1);
+    CHECK(frame.x[0] == 3072 && frame.y[0] == 5376);
+    frame = u1_frame(decoder, START, true, 2000, 1000);
+    CHECK(frame.x[0] == 3073 - 1000 && frame.y[0] == 5377 - 2000);
+}
+
+/* Zone edges are inclusive of the interior: 10% of 5375 is 537, 20% of 3071 is 614 */
+static void test_palm_zone_edges() {
+    static const struct {
+        UInt32 x, y;
+        bool palm;
+    } points[] = {
+        {538, 1500, false}, {537, 1500, true},
+        {4839, 1500, false}, {4840, 1500, true},
+        {2000, 1, false},
+        {2000, 2458, false}, {2000, 2459, true},
+    };
+    
+    alps_decoder decoder;
+    make_decoder(decoder);
+    alps_configure_palm_zones(decoder, 10, 10, 0, 20);
+    
+    decoder.key_time = START;
+    
+    for (size_t i = 0; i < sizeof(points) / sizeof(points[0]); i++) {
+        alps_frame frame = u1_frame(decoder, START + 10 * MS, true, points[i].x, points[i].y);
+        CHECK(frame.valid == (points[i].palm ? 0 : BIT(0)));
+        u1_frame(decoder, START + 10 * MS, false);
+    }
+}
+
+/* A still contact rests once it has been down resting_dwell, and is active for good once it travels */
+static void test_resting_thresholds() {
+    alps_decoder decoder;
+    make_decoder(decoder);
+    alps_configure_classifier(decoder, THUMB_ZONE_DEFAULT_PERCENT, 100 * MS, 40);
+    
+    CHECK(u1_frame(decoder, START, true, 2000, 1000).valid == BIT(0));
+    CHECK(u1_frame(decoder, START + 99 * MS, true, 2000, 1000).valid == BIT(0));
+    
+    alps_frame frame = u1_frame(decoder, START + 100 * MS, true, 2000, 1000);
+    CHECK(frame.valid == 0 && frame.contact_count == 0);
+    
+    CHECK(u1_frame(decoder, START + 110 * MS, true, 2020, 1020).valid == 0);
+    CHECK(u1_frame(decoder, START + 120 * MS, true, 2020, 1021).valid == BIT(0));
+    CHECK(u1_frame(decoder, START + 400 * MS, true, 2020, 1021).valid == BIT(0));
+    
+    // Travelling before the dwell time is up keeps it from ever resting
+    CHECK(u1_frame(decoder, START + 410 * MS, false).valid == 0);
+    CHECK(u1_frame(decoder, START + 420 * MS, true, 3000, 1000).valid == BIT(0));
+    CHECK(u1_frame(decoder, START + 430 * MS, true, 3041, 1000).valid == BIT(0));
+    CHECK(u1_frame(decoder, START + 440 * MS, true, 3000, 1000).valid == BIT(0));
+    CHECK(u1_frame(decoder, START + 900 * MS, true, 3000, 1000).valid == BIT(0));
+}
+
+/* A thumb is picked on a click or a fourth contact, and stays the thumb until it lifts */
+static void test_thumb_until_lift() {
+    alps_decoder decoder;
+    make_decoder(decoder);
+    
+    touch touches[3] = {{true, 2000, 1000}, {true, 3000, 2800}, {false, 0, 0}};
+    
+    CHECK(u1_touches(decoder, START, false, touches, 3).thumb == ALPS_T4_FRAME_NO_THUMB);
+    
+    // The click picks the contact that landed in the thumb zone
+    alps_frame frame = u1_touches(decoder, START + 10 * MS, true, touches, 3);
+    CHECK(frame.thumb == 1 && frame.button == (BIT(0) | BIT(1)));
+    
+    // Released, moved above the other contact, and outdone by a lower one, it is still the thumb
+    touches[1].y = 500;
+    CHECK(u1_touches(decoder, START + 20 * MS, false, touches, 3).thumb == 1);
+    touches[2] = {true, 4000, 3000};
+    CHECK(u1_touches(decoder, START + 30 * MS, true, touches, 3).thumb == 1);
+    
+    // Once it lifts nothing is the thumb until the next click
+    touches[1].down = false;
+    CHECK(u1_touches(decoder, START + 40 * MS, false, touches, 3).thumb == ALPS_T4_FRAME_NO_THUMB);
+    CHECK(u1_touches(decoder, START + 50 * MS, false, touches, 3).thumb == ALPS_T4_FRAME_NO_THUMB);
+    CHECK(u1_touches(decoder, START + 60 * MS, true, touches, 3).thumb == 2);
+}
+
+int main() {
+    test_t4_native_flip();
+    test_rotation_corners();
+    test_palm_zone_edges();
+    test_resting_thresholds();
+    test_thumb_until_lift();
+    
+    test_typing_quiet_time_ends();
+    test_typing_travel();
+    test_typing_palm_zones();
+    
+    return alps_test_result("DecoderTest");
+}
@@ -0,0 +1,176 @@
+//
+//  DeviceInitTest.cpp
+//  AlpsT4USB host build
+//
+//  Runs the device core's identification, init and mode recovery against the simulated
+//  register file in-process, including a failure at every step of each init sequence.
+//
+
+#include "AlpsSimulatedDevice.hpp"
+#include "AlpsTestSupport.hpp"
+
+static void test_identify() {
+    AlpsDevice device;
+    
+    CHECK(!device.identify(0x046D, HID_PRODUCT_ID_T4_USB));
+    CHECK(!device.identify(ALPS_VENDOR, 0x1234));
+    
+    CHECK(device.identify(ALPS_VENDOR, HID_PRODUCT_ID_G1));
+    CHECK(device.type == T4 && device.absolute_report_id == T4_INPUT_REPORT_ID);
+    
+    CHECK(device.identify(ALPS_VENDOR, HID_PRODUCT_ID_U1));
+    CHECK(device.type == U1 && device.absolute_report_id == U1_ABSOLUTE_REPORT_ID);
+    
+    // Nothing to talk to yet
+    const char *step = NULL;
+    CHECK(device.device_init(&step) == kIOReturnNotReady);
+    CHECK(step != NULL);
+}
+
+static void test_t4_init(UInt32 product_id, UInt32 lines_x, UInt32 lines_y, UInt8 sys_config) {
+    AlpsSimulatedDevice sim(product_id);
+    AlpsSimulatedTransport transport(sim);
+    AlpsDevice device;
+    
+    CHECK(device.identify(ALPS_VENDOR, product_id));
+    device.set_transport(&transport);
+    
+    const char *step = NULL;
+    CHECK(device.device_init(&step) == kIOReturnSuccess);
+    CHECK(step == NULL);
+    
+    CHECK(sim.reg(PRM_SYS_CONFIG_1) == sys_config);
+    CHECK(sim.reg(T4_PRM_FEED_CONFIG_1) == T4_I2C_ABS);
+    CHECK(sim.reg(T4_PRM_FEED_CONFIG_4) == T4_FEEDCFG4_ADVANCED_ABS_ENABLE);
+    CHECK(device.t4_sys_config == sys_config);
+    
+    CHECK(device.pri_data.x_max == lines_x * T4_COUNT_PER_ELECTRODE);
+    CHECK(device.pri_data.y_max == lines_y * T4_COUNT_PER_ELECTRODE);
+    CHECK(device.pri_data.x_min == T4_COUNT_PER_ELECTRODE);
+    CHECK(device.pri_data.max_fingers == 5);
+    CHECK(device.physical_max_x() == T4_PHYSICAL_MAX_X);
+    CHECK(device.physical_max_y() == T4_PHYSICAL_MAX_Y);
+    
+    // The watchdog's view: in mode, knocked out of it, restored
+    CHECK(device.in_absolute_mode());
+    sim.setReg(T4_PRM_FEED_CONFIG_1, 0);
+    CHECK(!device.in_absolute_mode());
+    CHECK(device.restore_absolute_mode() == kIOReturnSuccess);
+    CHECK(sim.inAbsoluteMode());
+    
+    // A reply with a bad checksum is an error, not a value
+    UInt8 value = 0;
+    sim.corruptNextReply();
+    CHECK(device.t4_read_write_register(PRM_SYS_CONFIG_1, &value, 0, true) == kIOReturnIOError);
+    CHECK(device.t4_read_write_register(PRM_SYS_CONFIG_1, &value, 0, true) == kIOReturnSuccess);
+    CHECK(value == sys_config);
+}
+
+static void test_u1_init(UInt32 product_id, bool stick) {
+    AlpsSimulatedDevice sim(product_id);
+    AlpsSimulatedTransport transport(sim);
+    AlpsDevice device;
+    
+    CHECK(device.identify(ALPS_VENDOR, product_id));
+    device.set_transport(&transport);
+    
+    CHECK(device.device_init(NULL) == kIOReturnSuccess);
+    
+    UInt8 dev_ctrl = U1_TP_ABS_MODE | (stick ? U1_SP_ABS_MODE : 0);
+    CHECK(device.has_stick == stick);
+    CHECK(sim.reg(ADDRESS_U1_DEV_CTRL_1) == dev_ctrl);
+    CHECK(device.u1_dev_ctrl == dev_ctrl);
+    
+    CHECK(device.pri_data.x_max == (0x40u << 2) * (23 - 1));
+    CHECK(device.pri_data.y_max == (0x40u << 2) * (13 - 1));
+    CHECK(device.pri_data.x_min == 1 && device.pri_data.y_min == 1);
+    CHECK(device.pri_data.x_active_len_mm == 48 * (23 - 1) / 10);
+    CHECK(device.physical_max_x() == device.pri_data.x_active_len_mm * 10);
+    CHECK(device.pri_data.btn_cnt == 1);
+    
+    CHECK(device.in_absolute_mode());
+    sim.setReg(ADDRESS_U1_DEV_CTRL_1, U1_DISABLE_DEV);
+    CHECK(!device.in_absolute_mode());
+    CHECK(device.restore_absolute_mode() == kIOReturnSuccess);
+    CHECK(sim.reg(ADDRESS_U1_DEV_CTRL_1) == dev_ctrl);
+}
+
+/* Every transfer of a good init, failed in turn, has to fail the init and say where */
+static void test_init_failures(UInt32 product_id) {
+    unsigned transfers;
+    {
+        AlpsSimulatedDevice sim(product_id);
+        AlpsSimulatedTransport transport(sim);
+        AlpsDevice device;
+        device.identify(ALPS_VENDOR, product_id);
+        device.set_transport(&transport);
+        CHECK(device.device_init(NULL) == kIOReturnSuccess);
+        transfers = sim.transfers();
+    }
+    
+    for (unsigned i = 0; i < transfers; i++) {
+        AlpsSimulatedDevice sim(product_id);
+        AlpsSimulatedTransport transport(sim);
+        AlpsDevice device;
+        device.identify(ALPS_VENDOR, product_id);
+        device.set_transport(&transport);
+        
+        sim.failTransfer(i);
+        
+        const char *step = NULL;
+        CHECK(device.device_init(&step) == kIOReturnIOError);
+        CHECK(step != NULL);
+    }
+}
+
+/* Register probes reach a host sink in START/END pairs tagged with the instance */
+static void test_register_trace(UInt32 product_id) {
+    const uint64_t instance = 0xA175;
+    AlpsSimulatedDevice sim(product_id);
+    AlpsSimulatedTransport transport(sim);
+    AlpsDevice device;
+    AlpsTrace trace;
+    alps_trace_log log;
+    
+    trace.setSink(alps_trace_log::sink, &log);
+    device.identify(ALPS_VENDOR, product_id);
+    device.set_transport(&transport);
+    device.set_trace(&trace);
+    
+    // Disabled probes record nothing
+    CHECK(device.device_init(NULL) == kIOReturnSuccess);
+    CHECK(log.records.empty());
+    
+    trace.setEnabled(true, instance);
+    CHECK(device.device_init(NULL) == kIOReturnSuccess);
+    
+    bool tagged = true;
+    size_t started = log.count(kAlpsTraceRegister, DBG_FUNC_START, instance, &tagged);
+    size_t ended = log.count(kAlpsTraceRegister, DBG_FUNC_END, instance, &tagged);
+    CHECK(started > 0 && started == ended);
+    CHECK(started == log.records.size() / 2);
+    CHECK(tagged);
+    
+    for (size_t i = 0; i < log.records.size(); i++) {
+        if (log.records[i].func == DBG_FUNC_END)
+            CHECK(log.records[i].arg[1] == kIOReturnSuccess && log.records[i].arg[3] == kAlpsRegisterOK);
+    }
+}
+
+int main() {
+    test_identify();
+    
+    test_t4_init(HID_PRODUCT_ID_T4_USB, T4_DEFAULT_SEN_LINE_NUM_X, T4_DEFAULT_SEN_LINE_NUM_Y, 0x02);
+    test_t4_init(HID_PRODUCT_ID_T4_BTNLESS, 17, 14, 0x40 | 0x02);
+    test_u1_init(HID_PRODUCT_ID_U1, false);
+    test_u1_init(HID_PRODUCT_ID_U1_DUAL, true);
+    
+    test_init_failures(HID_PRODUCT_ID_T4_USB);
+    test_init_failures(HID_PRODUCT_ID_T4_BTNLESS);
+    test_init_failures(HID_PRODUCT_ID_U1_DUAL);
+    
+    test_register_trace(HID_PRODUCT_ID_T4_USB);
+    test_register_trace(HID_PRODUCT_ID_U1);
+    
+    return alps_test_result("DeviceInitTest");
+}
@@ -0,0 +1,112 @@
+//
+//  FuzzReplayMain.cpp
+//  AlpsT4USB host build
+//
+//  Stands in for libFuzzer's driver where it is not available (GCC): runs
+//  LLVMFuzzerTestOneInput over the given files and directories, and with --random N over
+//  N inputs from a fixed seed, so a failure reproduces on every run.
+//
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#define RANDOM_SEED             0xA175
+#define RANDOM_MAX_LEN          4096
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static bool replay_file(const std::string &path) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) {
+        perror(path.c_str());
+        return false;
+    }
+    
+    std::vector<uint8_t> input;
+    uint8_t buffer[4096];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        input.insert(input.end(), buffer, buffer + count);
+    fclose(file);
+    
+    LLVMFuzzerTestOneInput(input.data(), input.size());
+    return true;
+}
+
+/* Files in sorted order, so a run is the same on every machine */
+static int replay_path(const std::string &path) {
+    struct stat st;
+    if (stat(path.c_str(), &st)) {
+        perror(path.c_str());
+        return -1;
+    }
+    
+    if (!S_ISDIR(st.st_mode))
+        return replay_file(path) ? 1 : -1;
+    
+    struct dirent **entries;
+    int entry_count = scandir(path.c_str(), &entries, NULL, alphasort);
+    if (entry_count < 0) {
+        perror(path.c_str());
+        return -1;
+    }
+    
+    int replayed = 0;
+    for (int i = 0; i < entry_count; i++) {
+        std::string name = entries[i]->d_name;
+        std::string child = path + "/" + name;
+        free(entries[i]);
+        
+        if (stat(child.c_str(), &st) || !S_ISREG(st.st_mode))
+            continue;
+        if (name.size() < 4 || name.compare(name.size() - 4, 4, ".bin"))
+            continue;
+        
+        if (replay_file(child))
+            replayed++;
+    }
+    free(entries);
+    
+    return replayed;
+}
+
+static void replay_random(unsigned count) {
+    std::mt19937 rng(RANDOM_SEED);
+    std::vector<uint8_t> input;
+    
+    for (unsigned i = 0; i < count; i++) {
+        input.resize(6 + rng() % RANDOM_MAX_LEN);
+        for (size_t j = 0; j < input.size(); j++)
+            input[j] = (uint8_t) rng();
+        
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+    }
+}
+
+int main(int argc, char **argv) {
+    int replayed = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--random") && i + 1 < argc) {
+            unsigned count = (unsigned) strtoul(argv[++i], NULL, 0);
+            replay_random(count);
+            replayed += count;
+            continue;
+        }
+        
+        int ret = replay_path(argv[i]);
+        if (ret < 0)
+            return 1;
+        replayed += ret;
+    }
+    
+    printf("FuzzReports: %d inputs replayed\n", replayed);
+    return replayed ? 0 : 1;
+}
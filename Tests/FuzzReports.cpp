@@ -0,0 +1,278 @@
+//
+//  FuzzReports.cpp
+//  AlpsT4USB host build
+//
+//  libFuzzer entry point for the report path: decode, classify, emit and publish to the
+//  frame ring, with every frame checked against the reference model, which is configured
+//  from the input header on its own, and a few invariants. The drop, decode and emit probes
+//  are on throughout and have to fire once per report with the instance tag.
+//  Any mismatch aborts, so the sanitizers and the fuzzer both report it as a crash.
+//
+//  Input layout, see also Tests/corpus/make_corpus.py:
+//    [0]  product: T4_USB, T4_BTNLESS, G1, U1, U1_DUAL, modulo 5
+//    [1]  bits 0-1 clockwise quarter turns, bit 2 invert x, bit 3 invert y, bit 4 frame ring
+//    [2]  palm zone left and right, a nibble each, in 6% steps
+//    [3]  palm zone top and bottom, likewise
+//    [4]  thumb zone percentage
+//    [5]  low nibble resting dwell in 16 ms steps (0 is off), high nibble resting travel in 16-unit steps
+//  followed by records of
+//    [0]  ms since the previous record
+//    [1]  bit 0 set: a key press, nothing follows; clear: an input report follows
+//    ...  the report without its ID, 50 bytes on T4, 27 on U1
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <deque>
+
+#include "AlpsDecoder.hpp"
+#include "AlpsHostEvent.hpp"
+#include "AlpsReferenceModel.hpp"
+#include "AlpsSimulatedDevice.hpp"
+
+#define FUZZ_HEADER_LEN         6
+#define FUZZ_QUIET_TIME_NS      500000000ull
+#define FUZZ_START_NS           1000000000ull   /* past the quiet time, as any real uptime is */
+#define FUZZ_DRAIN_INTERVAL     97              /* reports between drains, more than the ring holds */
+#define FUZZ_TRACE_INSTANCE     0xF022
+
+static const UInt32 fuzz_products[] = {
+    HID_PRODUCT_ID_T4_USB,
+    HID_PRODUCT_ID_T4_BTNLESS,
+    HID_PRODUCT_ID_G1,
+    HID_PRODUCT_ID_U1,
+    HID_PRODUCT_ID_U1_DUAL,
+};
+
+#define FUZZ_FAIL(...) do {                         \
+    fprintf(stderr, "FuzzReports: " __VA_ARGS__);   \
+    fputc('\n', stderr);                            \
+    abort();                                        \
+} while (0)
+
+/* Probe records per trace point, and the last one taken */
+struct fuzz_trace {
+    unsigned records[kAlpsTracePower + 1];
+    UInt32 func;
+    uintptr_t arg1;
+    
+    static void sink(void* context, UInt32 code, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t arg4, uintptr_t arg5) {
+        fuzz_trace *trace = static_cast<fuzz_trace *>(context);
+        UInt32 point = (code & 0xFFFC) >> 2;
+        
+        if ((code & ~0xFFFFu) != ALPS_TRACE_CODE(0) || point > kAlpsTracePower)
+            FUZZ_FAIL("trace code %#x is not one of ours", code);
+        if (arg5 != FUZZ_TRACE_INSTANCE)
+            FUZZ_FAIL("trace point %u tagged %#lx, not with the instance", point, (unsigned long) arg5);
+        
+        trace->records[point]++;
+        trace->func = code & 0x3;
+        trace->arg1 = arg1;
+    }
+};
+
+/* Each rejected report takes one drop record saying why, accepted ones take none */
+static void check_drop(const alps_decoder &decoder, fuzz_trace &records, bool ready, bool input, UInt32 report_id, uintptr_t reason) {
+    unsigned drops = records.records[kAlpsTraceDrop];
+    
+    if (alps_accept_report(decoder, ready, input, input ? 0 : 1, report_id) != !reason)
+        FUZZ_FAIL("report %#x %s", report_id, reason ? "accepted" : "dropped");
+    if (records.records[kAlpsTraceDrop] != drops + !!reason || (reason && records.arg1 != reason))
+        FUZZ_FAIL("report %#x dropped without the reason %lu", report_id, (unsigned long) reason);
+}
+
+/* What the consumer side of the ring expects, in order */
+static void check_ring_frame(const AlpsT4Frame &ring_frame, const alps_frame &frame) {
+    if (ring_frame.timestamp != frame.timestamp || ring_frame.contact_count != frame.contact_count ||
+        ring_frame.valid != frame.valid || ring_frame.button != (frame.button != 0) || ring_frame.thumb != frame.thumb ||
+        memcmp(ring_frame.x, frame.x, sizeof(frame.x)) || memcmp(ring_frame.y, frame.y, sizeof(frame.y)))
+        FUZZ_FAIL("ring frame at %llu differs from the one published", (unsigned long long) frame.timestamp);
+}
+
+static void drain_ring(AlpsT4FrameRing &ring, std::deque<alps_frame> &published) {
+    UInt32 head = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+    UInt32 tail = ring.tail;
+    
+    for (; tail != head; tail++) {
+        if (published.empty())
+            FUZZ_FAIL("ring holds %u frames more than were published", head - tail);
+        
+        check_ring_frame(ring.frames[tail % ALPS_T4_FRAME_RING_CAPACITY], published.front());
+        published.pop_front();
+    }
+    
+    __atomic_store_n(&ring.tail, tail, __ATOMIC_RELEASE);
+    
+    if (!published.empty())
+        FUZZ_FAIL("%zu published frames never reached the ring", published.size());
+}
+
+static void check_invariants(const alps_decoder &decoder, const alps_frame &frame) {
+    if (frame.valid & ~ALPS_ALL_SLOTS)
+        FUZZ_FAIL("valid %#x has bits past the last slot", frame.valid);
+    for (int i = 0; i < MAX_TOUCHES; i++) {
+        if ((frame.valid & BIT(i)) &&
+            (frame.x[i] < decoder.logical_min_x || frame.x[i] > decoder.logical_max_x ||
+             frame.y[i] < decoder.logical_min_y || frame.y[i] > decoder.logical_max_y))
+            FUZZ_FAIL("contact %d at %u, %u is outside the logical bounds", i, frame.x[i], frame.y[i]);
+    }
+    if (frame.thumb != ALPS_T4_FRAME_NO_THUMB && !(frame.valid & BIT(frame.thumb)))
+        FUZZ_FAIL("thumb %u is not touching, valid %#x", frame.thumb, frame.valid);
+    
+    if (decoder.type == T4) {
+        if (frame.contact_count != MAX_TOUCHES)
+            FUZZ_FAIL("T4 contact_count %u", frame.contact_count);
+        if (frame.button != 0 && frame.button != ALPS_ALL_SLOTS)
+            FUZZ_FAIL("T4 button %#x is not on every slot", frame.button);
+    } else {
+        if (frame.contact_count != __builtin_popcount(frame.valid))
+            FUZZ_FAIL("U1 contact_count %u for valid %#x", frame.contact_count, frame.valid);
+        if (frame.button & ~frame.valid)
+            FUZZ_FAIL("U1 button %#x on slots that are not touching, valid %#x", frame.button, frame.valid);
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (size < FUZZ_HEADER_LEN)
+        return 0;
+    
+    UInt32 product_id = fuzz_products[data[0] % (sizeof(fuzz_products) / sizeof(fuzz_products[0]))];
+    AlpsSimulatedDevice sim(product_id);
+    AlpsSimulatedTransport transport(sim);
+    AlpsDevice device;
+    
+    const char *step = NULL;
+    if (!device.identify(ALPS_VENDOR, product_id))
+        FUZZ_FAIL("product %04x not identified", product_id);
+    device.set_transport(&transport);
+    if (device.device_init(&step) != kIOReturnSuccess)
+        FUZZ_FAIL("could not %s", step);
+    
+    alps_decoder decoder;
+    memset(&decoder, 0, sizeof(decoder));
+    decoder.max_after_typing = FUZZ_QUIET_TIME_NS;
+    
+    AlpsTrace trace;
+    fuzz_trace records;
+    memset(&records, 0, sizeof(records));
+    trace.setSink(fuzz_trace::sink, &records);
+    trace.setEnabled(true, FUZZ_TRACE_INSTANCE);
+    decoder.trace = &trace;
+    
+    UInt32 quarter_turns = data[1] & 0x3;
+    bool invert_x = data[1] & 0x4, invert_y = data[1] & 0x8;
+    UInt32 palm_left = (data[2] & 0xF) * 6, palm_right = (data[2] >> 4) * 6;
+    UInt32 palm_top = (data[3] & 0xF) * 6, palm_bottom = (data[3] >> 4) * 6;
+    uint64_t resting_dwell = (data[5] & 0xF) * 16000000ull;
+    UInt32 resting_travel = (data[5] >> 4) * 16;
+    
+    alps_configure_transform(decoder, device.type, device.pri_data, quarter_turns, invert_x, invert_y);
+    alps_configure_palm_zones(decoder, palm_left, palm_right, palm_top, palm_bottom);
+    alps_configure_classifier(decoder, data[4], resting_dwell, resting_travel);
+    
+    UInt32 absolute_id = device.type == T4 ? T4_INPUT_REPORT_ID : U1_ABSOLUTE_REPORT_ID;
+    check_drop(decoder, records, false, true, absolute_id, kAlpsDropNotReady);
+    check_drop(decoder, records, true, false, absolute_id, kAlpsDropNotInput);
+    check_drop(decoder, records, true, true, absolute_id ^ 0x80, kAlpsDropForeignReport);
+    check_drop(decoder, records, true, true, absolute_id, 0);
+    
+    AlpsReferenceModel<AlpsHostEvent> reference;
+    reference.configure(device.type, device.pri_data, quarter_turns, invert_x, invert_y);
+    reference.configure_palm_zones(palm_left, palm_right, palm_top, palm_bottom, FUZZ_QUIET_TIME_NS);
+    reference.configure_classifier(data[4], resting_dwell, resting_travel);
+    
+    AlpsHostEvent event;
+    alps_emitted emitted;
+    alps_reset_event(event, emitted);
+    
+    bool use_ring = data[1] & 0x10;
+    static AlpsT4FrameRing ring;
+    std::deque<alps_frame> published;
+    UInt32 dropped = 0;
+    memset(&ring, 0, sizeof(ring));
+    
+    size_t report_len = device.type == T4 ? T4_INPUT_REPORT_LEN - 1 : U1_ABSOLUTE_REPORT_LEN - 1;
+    AbsoluteTime now = FUZZ_START_NS;
+    AbsoluteTime key_time = 0;
+    unsigned reports = 0;
+    
+    for (size_t offset = FUZZ_HEADER_LEN; offset + 2 <= size;) {
+        now += data[offset] * 1000000ull;
+        UInt8 kind = data[offset + 1];
+        offset += 2;
+        
+        if (kind & 1) {
+            key_time = now;
+            decoder.key_time = now;
+            continue;
+        }
+        
+        if (offset + report_len > size)
+            break;
+        
+        alps_frame frame;
+        unsigned decodes = records.records[kAlpsTraceDecode];
+        
+        if (device.type == T4) {
+            t4_input_report report;
+            report.reportID = T4_INPUT_REPORT_ID;
+            memcpy((UInt8 *) &report + 1, data + offset, report_len);
+            
+            alps_t4_decode(decoder, report, now, frame);
+            alps_classify_contacts(decoder, frame);
+            reference.t4_event(report, key_time, now);
+        } else {
+            UInt8 report[U1_ABSOLUTE_REPORT_LEN];
+            report[0] = U1_ABSOLUTE_REPORT_ID;
+            memcpy(report + 1, data + offset, report_len);
+            
+            alps_u1_decode(decoder, report, now, frame);
+            alps_classify_contacts(decoder, frame);
+            reference.u1_event(report, key_time, now);
+        }
+        offset += report_len;
+        
+        if (records.records[kAlpsTraceDecode] != decodes + 1 || records.arg1 != frame.valid)
+            FUZZ_FAIL("report %u did not take exactly one decode record", reports);
+        
+        check_invariants(decoder, frame);
+        
+        alps_update_event(event, emitted, frame);
+        
+        int slot;
+        const char *field = reference.compare(event, slot);
+        if (field)
+            FUZZ_FAIL("report %u differs from the reference model in %s, slot %d", reports, field, slot);
+        
+        if (use_ring) {
+            bool was_empty = ring.head == ring.tail;
+            bool full = ring.head - ring.tail >= ALPS_T4_FRAME_RING_CAPACITY;
+            unsigned emits = records.records[kAlpsTraceEmit];
+            
+            if (alps_publish_ring_frame(decoder, &ring, frame) != (was_empty && !full))
+                FUZZ_FAIL("publish did not report the ring going from empty to non-empty");
+            if (records.records[kAlpsTraceEmit] != emits + 1 || records.func != DBG_FUNC_NONE)
+                FUZZ_FAIL("report %u did not take exactly one emit record", reports);
+            
+            if (full)
+                dropped++;
+            else
+                published.push_back(frame);
+            
+            if (ring.dropped != dropped)
+                FUZZ_FAIL("ring counted %u drops, expected %u", ring.dropped, dropped);
+            
+            if (!(++reports % FUZZ_DRAIN_INTERVAL))
+                drain_ring(ring, published);
+        } else {
+            reports++;
+        }
+    }
+    
+    if (use_ring)
+        drain_ring(ring, published);
+    
+    return 0;
+}
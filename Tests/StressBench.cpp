@@ -0,0 +1,358 @@
+//
+//  StressBench.cpp
+//  AlpsT4USB host build
+//
+//  Runs one simulated device per thread through the whole report path (decode, palm and
+//  resting-finger tracking, thumb detection, emit, frame ring) with a register read every
+//  so often, and reports how throughput scales with the thread count. Every thread's
+//  output is checksummed against a run of the same script on its own, so state shared
+//  between instances shows up as a mismatch and not just as a slowdown.
+//
+//  StressBench [--frames N] [--max-threads N]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "AlpsDecoder.hpp"
+#include "AlpsHostEvent.hpp"
+#include "AlpsSimulatedDevice.hpp"
+
+#define SCRIPT_REPORTS          4096
+#define SCRIPT_FINGERS          3
+#define DEFAULT_FRAMES          2000000     /* per thread */
+#define DRAIN_INTERVAL          32          /* frames between ring drains */
+#define REGISTER_INTERVAL       4096        /* frames between mode register reads */
+#define REPORT_INTERVAL_NS      8000000ull  /* 125 Hz */
+#define FNV_OFFSET              0xCBF29CE484222325ull
+#define FNV_PRIME               0x100000001B3ull
+
+static const UInt32 bench_products[] = {
+    HID_PRODUCT_ID_T4_USB,
+    HID_PRODUCT_ID_U1,
+    HID_PRODUCT_ID_T4_BTNLESS,
+    HID_PRODUCT_ID_U1_DUAL,
+};
+
+/* One scripted input report, or a key press when key is set */
+struct bench_record {
+    bool key;
+    UInt8 report[T4_INPUT_REPORT_LEN];
+};
+
+/* Random walks of up to SCRIPT_FINGERS fingers that land, move, click and lift */
+static std::vector<bench_record> make_script(bool t4, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::vector<bench_record> script;
+    bool down[SCRIPT_FINGERS] = {};
+    UInt32 x[SCRIPT_FINGERS] = {}, y[SCRIPT_FINGERS] = {};
+    bool button = false;
+    
+    while (script.size() < SCRIPT_REPORTS) {
+        bench_record record = {};
+        
+        if (rng() % 64 == 0) {
+            record.key = true;
+            script.push_back(record);
+            continue;
+        }
+        
+        for (int i = 0; i < SCRIPT_FINGERS; i++) {
+            if (!down[i] && rng() % 16 == 0) {
+                down[i] = true;
+                x[i] = 400 + rng() % 3000;
+                y[i] = 400 + rng() % 2400;
+            } else if (down[i] && rng() % 48 == 0) {
+                down[i] = false;
+            } else if (down[i] && rng() % 4) {
+                x[i] += rng() % 21 - 10;
+                y[i] += rng() % 21 - 10;
+            }
+        }
+        if (rng() % 32 == 0)
+            button = !button;
+        
+        if (t4) {
+            t4_input_report *report = (t4_input_report *) record.report;
+            report->reportID = T4_INPUT_REPORT_ID;
+            for (int i = 0; i < SCRIPT_FINGERS; i++) {
+                if (down[i])
+                    report->contact[i] = {0x3E, (UInt8) x[i], (UInt8) (x[i] >> 8), (UInt8) y[i], (UInt8) (y[i] >> 8)};
+            }
+            report->button = button;
+        } else {
+            record.report[0] = U1_ABSOLUTE_REPORT_ID;
+            record.report[1] = button;
+            for (int i = 0; i < SCRIPT_FINGERS; i++) {
+                UInt8 *contact = &record.report[i * 5];
+                if (!down[i])
+                    continue;
+                contact[3] = (UInt8) x[i];
+                contact[4] = (UInt8) (x[i] >> 8);
+                contact[5] = (UInt8) y[i];
+                contact[6] = (UInt8) (y[i] >> 8);
+                contact[7] = 0x30;
+            }
+        }
+        
+        script.push_back(record);
+    }
+    
+    return script;
+}
+
+/* Everything one device needs, allocated on its own and padded at both ends so neighbouring
+   instances never share a cache line (C++14 new ignores alignas past 16 bytes) */
+struct bench_instance {
+    explicit bench_instance(UInt32 product_id, unsigned seed) : sim(product_id), transport(sim) {
+        memset(&decoder, 0, sizeof(decoder));
+        memset(&ring, 0, sizeof(ring));
+        
+        const char *step = "identify the device";
+        if (!device.identify(ALPS_VENDOR, product_id)) {
+            fprintf(stderr, "StressBench: could not %s %04x\n", step, product_id);
+            exit(1);
+        }
+        
+        device.set_transport(&transport);
+        if (device.device_init(&step) != kIOReturnSuccess) {
+            fprintf(stderr, "StressBench: could not %s on %04x\n", step, product_id);
+            exit(1);
+        }
+        
+        script = make_script(device.type == T4, seed);
+        
+        decoder.max_after_typing = 100000000ull;
+        alps_configure_transform(decoder, device.type, device.pri_data, 0, false, false);
+        alps_configure_palm_zones(decoder, 10, 10, 0, 0);
+        alps_configure_classifier(decoder, THUMB_ZONE_DEFAULT_PERCENT, 200000000ull, RESTING_TRAVEL_DEFAULT);
+        alps_reset_event(event, emitted);
+    }
+    
+    void drain(UInt64 &checksum) {
+        UInt32 head = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+        
+        for (UInt32 tail = ring.tail; tail != head; tail++) {
+            const AlpsT4Frame &frame = ring.frames[tail % ALPS_T4_FRAME_RING_CAPACITY];
+            
+            checksum = (checksum ^ (frame.valid | frame.button << 8 | frame.thumb << 16 | (UInt64) frame.contact_count << 24)) * FNV_PRIME;
+            for (int i = 0; i < ALPS_T4_FRAME_MAX_CONTACTS; i++) {
+                if (frame.valid & BIT(i))
+                    checksum = (checksum ^ ((UInt64) frame.x[i] << 32 | frame.y[i])) * FNV_PRIME;
+            }
+        }
+        
+        __atomic_store_n(&ring.tail, head, __ATOMIC_RELEASE);
+    }
+    
+    void start() {
+        checksum = FNV_OFFSET;
+        now = 1000000000ull;
+        next = 0;
+        done = 0;
+    }
+    
+    /* Runs the next scripted record through the pipeline, done counts the reports among them */
+    void step() {
+        const bench_record &record = script[next];
+        next = (next + 1) % script.size();
+        now += REPORT_INTERVAL_NS;
+        
+        if (record.key) {
+            decoder.key_time = now;
+            return;
+        }
+        
+        alps_frame frame;
+        if (device.type == T4)
+            alps_t4_decode(decoder, *(const t4_input_report *) record.report, now, frame);
+        else
+            alps_u1_decode(decoder, record.report, now, frame);
+        alps_classify_contacts(decoder, frame);
+        
+        alps_update_event(event, emitted, frame);
+        alps_publish_ring_frame(decoder, &ring, frame);
+        
+        done++;
+        
+        if (!(done % DRAIN_INTERVAL)) {
+            drain(checksum);
+            checksum = (checksum ^ event.contact_count) * FNV_PRIME;
+        }
+        
+        // Register traffic on the same thread, as the watchdog does between reports
+        if (!(done % REGISTER_INTERVAL) && !device.in_absolute_mode()) {
+            fprintf(stderr, "StressBench: %04x left absolute mode\n", sim.productID());
+            exit(1);
+        }
+    }
+    
+    /* Checksum of everything that came out since start() */
+    UInt64 finish() {
+        drain(checksum);
+        return checksum ^ ring.dropped;
+    }
+    
+    UInt64 run(unsigned frames) {
+        start();
+        while (done < frames)
+            step();
+        return finish();
+    }
+    
+    UInt8 pad_head[64];
+    AlpsSimulatedDevice sim;
+    AlpsSimulatedTransport transport;
+    AlpsDevice device;
+    std::vector<bench_record> script;
+    
+    alps_decoder decoder;
+    AlpsHostEvent event;
+    alps_emitted emitted;
+    AlpsT4FrameRing ring;
+    
+    UInt64 checksum;
+    AbsoluteTime now;
+    size_t next;
+    unsigned done;
+    UInt8 pad_tail[64];
+};
+
+static std::unique_ptr<bench_instance> make_instance(unsigned index) {
+    UInt32 product_id = bench_products[index % (sizeof(bench_products) / sizeof(bench_products[0]))];
+    return std::unique_ptr<bench_instance>(new bench_instance(product_id, 0xA175 + index));
+}
+
+/* All instances on one thread, a report each in turn, so shared state shows on any machine */
+static bool run_interleaved(unsigned count, unsigned frames, const std::vector<UInt64> &expected) {
+    std::vector<std::unique_ptr<bench_instance>> instances;
+    for (unsigned i = 0; i < count; i++) {
+        instances.push_back(make_instance(i));
+        instances[i]->start();
+    }
+    
+    for (unsigned frame = 0; frame < frames; frame++) {
+        for (unsigned i = 0; i < count; i++) {
+            unsigned target = instances[i]->done + 1;
+            while (instances[i]->done < target)
+                instances[i]->step();
+        }
+    }
+    
+    bool matched = true;
+    for (unsigned i = 0; i < count; i++) {
+        UInt64 checksum = instances[i]->finish();
+        if (checksum != expected[i]) {
+            fprintf(stderr, "StressBench: instance %u produced %016llx interleaved, %016llx alone\n", i,
+                    (unsigned long long) checksum, (unsigned long long) expected[i]);
+            matched = false;
+        }
+    }
+    
+    return matched;
+}
+
+/* Runs threads instances at once, false if any of them disagrees with its solo checksum */
+static bool run_threads(unsigned threads, unsigned frames, const std::vector<UInt64> &expected, double &seconds) {
+    std::vector<std::unique_ptr<bench_instance>> instances;
+    for (unsigned i = 0; i < threads; i++)
+        instances.push_back(make_instance(i));
+    
+    std::vector<UInt64> checksums(threads);
+    std::vector<std::thread> workers;
+    std::atomic<unsigned> waiting(threads);
+    std::atomic<bool> go(false);
+    
+    for (unsigned i = 0; i < threads; i++) {
+        workers.emplace_back([&, i] {
+            waiting--;
+            while (!go.load(std::memory_order_acquire))
+                std::this_thread::yield();
+            checksums[i] = instances[i]->run(frames);
+        });
+    }
+    
+    while (waiting.load())
+        std::this_thread::yield();
+    
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (std::thread &worker : workers)
+        worker.join();
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    
+    bool matched = true;
+    for (unsigned i = 0; i < threads; i++) {
+        if (checksums[i] != expected[i]) {
+            fprintf(stderr, "StressBench: instance %u produced %016llx with %u threads, %016llx alone\n", i,
+                    (unsigned long long) checksums[i], threads, (unsigned long long) expected[i]);
+            matched = false;
+        }
+    }
+    
+    return matched;
+}
+
+int main(int argc, char **argv) {
+    unsigned frames = DEFAULT_FRAMES;
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    unsigned max_threads = std::max(4u, cores);
+    
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--frames"))
+            frames = (unsigned) strtoul(argv[i + 1], NULL, 0);
+        else if (!strcmp(argv[i], "--max-threads"))
+            max_threads = std::max(1u, (unsigned) strtoul(argv[i + 1], NULL, 0));
+    }
+    
+#if ALPS_SANITIZED
+    printf("StressBench: built with sanitizers, configure with -DALPS_SANITIZE=OFF for real numbers\n");
+#endif
+    
+    // What every instance produces when it has the machine to itself
+    std::vector<UInt64> expected;
+    for (unsigned i = 0; i < max_threads; i++)
+        expected.push_back(make_instance(i)->run(frames));
+    
+    bool matched = run_interleaved(max_threads, frames, expected);
+    
+    printf("StressBench: %u frames per thread, %u core(s)\n", frames, cores);
+    printf("%8s %14s %14s %12s\n", "threads", "frames/s", "per thread", "per core");
+    
+    // Powers of two, then max_threads itself
+    std::vector<unsigned> thread_counts;
+    for (unsigned threads = 1; threads < max_threads; threads *= 2)
+        thread_counts.push_back(threads);
+    thread_counts.push_back(max_threads);
+    
+    double single = 0;
+    
+    for (unsigned threads : thread_counts) {
+        double seconds;
+        matched &= run_threads(threads, frames, expected, seconds);
+        
+        double rate = (double) frames * threads / seconds;
+        if (threads == 1)
+            single = rate;
+        
+        // Throughput over what the busy cores would give if each ran as fast as one thread alone
+        double per_core = rate / (single * std::min(threads, cores));
+        printf("%8u %14.0f %14.0f %11.2fx%s\n", threads, rate, rate / threads, per_core,
+               threads > cores ? "  (more threads than cores)" : "");
+    }
+    
+    if (!matched)
+        return 1;
+    
+    printf("StressBench: every instance matched its single-threaded output, interleaved and in parallel\n");
+    return 0;
+}
@@ -0,0 +1,144 @@
+//
+//  UHIDTest.cpp
+//  AlpsT4USB host build
+//
+//  End to end through the kernel: the simulated device sits behind uhid, the device core
+//  talks to it over hidraw with AlpsHidrawTransport, and input reports it sends come back
+//  through hidraw into the decoder. Skipped where /dev/uhid is missing or not writable,
+//  which is the case in most containers.
+//
+
+#include "AlpsDecoder.hpp"
+#include "AlpsHidrawTransport.hpp"
+#include "AlpsUHIDDevice.hpp"
+#include "AlpsTestSupport.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#define REGISTER_ROUND_TRIPS    200
+#define INPUT_TIMEOUT_MS        1000
+
+/* One contact at (x, y) in device units, sent by the device and decoded as the driver would */
+static void test_input_over_hidraw(AlpsUHIDDevice &uhid, AlpsHidrawTransport &transport, AlpsDevice &device) {
+    UInt8 sent[T4_INPUT_REPORT_LEN] = {};
+    UInt32 length;
+    UInt32 x = 1000, y = 1200;
+    
+    if (device.type == T4) {
+        t4_input_report *report = (t4_input_report *) sent;
+        report->reportID = T4_INPUT_REPORT_ID;
+        report->numContacts = 1;
+        report->contact[0] = {0x3E, (UInt8) x, (UInt8) (x >> 8), (UInt8) y, (UInt8) (y >> 8)};
+        report->button = 1;
+        length = T4_INPUT_REPORT_LEN;
+    } else {
+        sent[0] = U1_ABSOLUTE_REPORT_ID;
+        sent[1] = 1;
+        sent[3] = (UInt8) x;
+        sent[4] = (UInt8) (x >> 8);
+        sent[5] = (UInt8) y;
+        sent[6] = (UInt8) (y >> 8);
+        sent[7] = 0x30;
+        length = U1_ABSOLUTE_REPORT_LEN;
+    }
+    
+    CHECK(uhid.sendInput(sent, length));
+    
+    UInt8 received[T4_INPUT_REPORT_LEN] = {};
+    int count = transport.readInputReport(received, sizeof(received), INPUT_TIMEOUT_MS);
+    CHECK(count == (int) length);
+    if (count != (int) length)
+        return;
+    CHECK(!memcmp(sent, received, length));
+    
+    alps_decoder decoder;
+    memset(&decoder, 0, sizeof(decoder));
+    alps_configure_transform(decoder, device.type, device.pri_data, 0, false, false);
+    alps_configure_palm_zones(decoder, 0, 0, 0, 0);
+    alps_configure_classifier(decoder, THUMB_ZONE_DEFAULT_PERCENT, 0, RESTING_TRAVEL_DEFAULT);
+    
+    alps_frame frame;
+    if (device.type == T4)
+        alps_t4_decode(decoder, *(const t4_input_report *) received, 0, frame);
+    else
+        alps_u1_decode(decoder, received, 0, frame);
+    alps_classify_contacts(decoder, frame);
+    
+    CHECK(frame.valid == BIT(0));
+    CHECK(frame.button & BIT(0));
+    CHECK(frame.thumb == 0);
+    CHECK(frame.x[0] == x);
+    CHECK(frame.y[0] == (device.type == T4 ? device.pri_data.y_min + device.pri_data.y_max - y : y));
+}
+
+static void test_init_over_hidraw(UInt32 product_id) {
+    AlpsSimulatedDevice sim(product_id);
+    AlpsUHIDDevice uhid;
+    
+    char uniq[64];
+    snprintf(uniq, sizeof(uniq), "alps-sim-%d-%04x", (int) getpid(), product_id);
+    
+    if (!uhid.create(&sim, uniq)) {
+        fprintf(stderr, "Could not create uhid device: %s\n", strerror(errno));
+        CHECK(false);
+        return;
+    }
+    
+    std::string path = uhid.waitForHidraw(5000);
+    CHECK(!path.empty());
+    if (path.empty())
+        return;
+    
+    AlpsHidrawTransport transport;
+    CHECK(transport.open(path.c_str()));
+    
+    AlpsDevice device;
+    CHECK(device.identify(ALPS_VENDOR, product_id));
+    device.set_transport(&transport);
+    
+    const char *step = NULL;
+    IOReturn ret = device.device_init(&step);
+    if (ret != kIOReturnSuccess)
+        fprintf(stderr, "Could not %s (%#x)\n", step, ret);
+    CHECK(ret == kIOReturnSuccess);
+    CHECK(sim.inAbsoluteMode());
+    CHECK(device.pri_data.x_max > device.pri_data.x_min);
+    
+    // Knock it out of absolute mode and let the watchdog's code path bring it back
+    sim.setReg(device.type == T4 ? T4_PRM_FEED_CONFIG_1 : ADDRESS_U1_DEV_CTRL_1, 0);
+    CHECK(!device.in_absolute_mode());
+    CHECK(device.restore_absolute_mode() == kIOReturnSuccess);
+    CHECK(device.in_absolute_mode());
+    
+    test_input_over_hidraw(uhid, transport, device);
+    
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < REGISTER_ROUND_TRIPS; i++)
+        device.in_absolute_mode();
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    
+    printf("%s %04x: %d register reads over hidraw, %.1f us each\n", device.type == T4 ? "T4" : "U1",
+           product_id, REGISTER_ROUND_TRIPS, elapsed.count() / REGISTER_ROUND_TRIPS);
+    
+    transport.close();
+    uhid.destroy();
+}
+
+int main() {
+    int probe = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+    if (probe < 0) {
+        printf("UHIDTest: skipped, /dev/uhid: %s\n", strerror(errno));
+        return ALPS_TEST_SKIPPED;
+    }
+    close(probe);
+    
+    test_init_over_hidraw(HID_PRODUCT_ID_T4_BTNLESS);
+    test_init_over_hidraw(HID_PRODUCT_ID_U1_DUAL);
+    
+    return alps_test_result("UHIDTest");
+}
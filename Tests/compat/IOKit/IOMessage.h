@@ -0,0 +1,16 @@
+//
+//  IOMessage.h
+//  AlpsT4USB host build
+//
+//  iokit_vendor_specific_msg() for the message codes in AlpsT4FrameRing.h, with the
+//  value xnu's IOMessage.h gives it.
+//
+
+#ifndef AlpsHost_IOMessage_h
+#define AlpsHost_IOMessage_h
+
+#include <IOKit/IOTypes.h>
+
+#define iokit_vendor_specific_msg(message)  ((UInt32) (0xE0000000 | (((-2) & 0xFFF) << 14) | (message)))
+
+#endif /* AlpsHost_IOMessage_h */
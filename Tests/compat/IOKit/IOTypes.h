@@ -0,0 +1,37 @@
+//
+//  IOTypes.h
+//  AlpsT4USB host build
+//
+//  The few IOKit types and return codes the transport-only sources use, so they build
+//  unchanged against Linux. Values match xnu's IOReturn.h.
+//
+
+#ifndef AlpsHost_IOTypes_h
+#define AlpsHost_IOTypes_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t     UInt8;
+typedef uint16_t    UInt16;
+typedef uint32_t    UInt32;
+typedef uint64_t    UInt64;
+typedef int8_t      SInt8;
+typedef int16_t     SInt16;
+typedef int32_t     SInt32;
+typedef int64_t     SInt64;
+
+typedef int         IOReturn;
+typedef uint64_t    AbsoluteTime;
+
+#define kIOReturnSuccess        0
+#define kIOReturnError          ((IOReturn) 0xE00002BC)
+#define kIOReturnNoMemory       ((IOReturn) 0xE00002BD)
+#define kIOReturnBadArgument    ((IOReturn) 0xE00002C2)
+#define kIOReturnUnsupported    ((IOReturn) 0xE00002C7)
+#define kIOReturnIOError        ((IOReturn) 0xE00002CA)
+#define kIOReturnTimeout        ((IOReturn) 0xE00002D6)
+#define kIOReturnNotReady       ((IOReturn) 0xE00002D8)
+#define kIOReturnNotFound       ((IOReturn) 0xE00002F0)
+
+#endif /* AlpsHost_IOTypes_h */
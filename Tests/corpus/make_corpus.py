@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+#
+# Writes the seed inputs for FuzzReports next to this script. The layout is described at
+# the top of Tests/FuzzReports.cpp; rerun this after changing it.
+#
+
+import os
+import struct
+
+T4_USB, T4_BTNLESS, G1, U1, U1_DUAL = range(5)
+
+
+def header(product, rotation=0, invert_x=False, invert_y=False, ring=False,
+           palm=(0, 0, 0, 0), thumb_zone=20, dwell=0, travel=0):
+    flags = rotation | invert_x << 2 | invert_y << 3 | ring << 4
+    return bytes([product, flags, palm[0] | palm[1] << 4, palm[2] | palm[3] << 4,
+                  thumb_zone, dwell | travel << 4])
+
+
+def t4_report(contacts, button=False):
+    """contacts: up to five (x, y) in device units, None for an empty slot"""
+    contacts = list(contacts) + [None] * (5 - len(contacts))
+    body = bytes([sum(c is not None for c in contacts)])
+    for c in contacts:
+        body += struct.pack("<BHH", 0x3E, *c) if c else bytes(5)
+    body += bytes([1 if button else 0])
+    body += bytes(5 + 5 + 5 + 5 + 1) + struct.pack("<H", 0)
+    assert len(body) == 50
+    return body
+
+
+def u1_report(contacts, button=False):
+    """contacts: up to five (x, y) in device units, None for an empty slot"""
+    contacts = list(contacts) + [None] * (5 - len(contacts))
+    data = bytearray(28)
+    data[1] = 1 if button else 0
+    for i, c in enumerate(contacts):
+        if c:
+            struct.pack_into("<HHB", data, i * 5 + 3, c[0], c[1], 0x30)
+    return bytes(data[1:])
+
+
+def report(body, dt=8):
+    return bytes([dt, 0]) + body
+
+
+def key(dt=8):
+    return bytes([dt, 1])
+
+
+def t4_tap():
+    seed = header(T4_USB)
+    for i in range(10):
+        seed += report(t4_report([(1000 + 20 * i, 1500)]))
+    return seed + report(t4_report([]))
+
+
+def t4_four_finger_click():
+    fingers = [(900, 1800), (1500, 1700), (2100, 1750), (1600, 300)]
+    seed = header(T4_BTNLESS)
+    for n in range(1, 5):
+        seed += report(t4_report(fingers[:n]))
+    for button in (True, True, False):
+        seed += report(t4_report(fingers, button))
+    for n in range(3, -1, -1):
+        seed += report(t4_report(fingers[:n]))
+    return seed
+
+
+def t4_click_without_contacts():
+    # A click with nothing touching must not leave a thumb behind for later contacts
+    seed = header(T4_USB)
+    for _ in range(3):
+        seed += report(t4_report([], True))
+    seed += report(t4_report([(1200, 1600)], True))
+    seed += report(t4_report([(1200, 1600)]))
+    seed += report(t4_report([]))
+    seed += report(t4_report([None, (2000, 1400)]))
+    return seed + report(t4_report([]))
+
+
+def t4_rotated_typing():
+    seed = header(G1, rotation=1, invert_x=True, palm=(3, 3, 2, 4))
+    seed += key()
+    seed += report(t4_report([(400, 1500)]), dt=20)
+    seed += report(t4_report([(400, 1500), (2000, 1600)]), dt=200)
+    seed += report(t4_report([(410, 1500), (2010, 1600)]), dt=250)
+    seed += key()
+    seed += report(t4_report([(420, 1500), (2020, 1600), (4000, 3300)]))
+    return seed + report(t4_report([]), dt=250)
+
+
+def u1_two_finger_scroll():
+    seed = header(U1, rotation=2, invert_y=True)
+    for i in range(12):
+        seed += report(u1_report([(2000, 1000 + 40 * i), (2600, 1000 + 40 * i)]))
+    return seed + report(u1_report([]))
+
+
+def u1_resting_click():
+    # A finger resting at the top while another clicks below: the resting slot is
+    # reported lifted and must not keep the button
+    seed = header(U1_DUAL, dwell=1, travel=1)
+    for _ in range(5):
+        seed += report(u1_report([(2000, 400)]), dt=10)
+    seed += report(u1_report([(2000, 400), (3000, 2900)]))
+    seed += report(u1_report([(2000, 400), (3000, 2900)], True))
+    seed += report(u1_report([(2000, 400), (3000, 2900)], True))
+    seed += report(u1_report([(2000, 400), (3000, 2900)]))
+    seed += report(u1_report([(2000, 400)]))
+    return seed + report(u1_report([]))
+
+
+def t4_ring_overflow():
+    # More frames than the ring holds between drains, with fingers coming and going
+    seed = header(T4_USB, ring=True, dwell=4, travel=2)
+    for i in range(200):
+        fingers = [(800 + 3 * i, 1500), (1800, 1500 - 2 * i), None, (3000, 350)][:1 + i % 4]
+        seed += report(t4_report(fingers, i % 50 > 40), dt=1 + i % 9)
+    return seed + report(t4_report([]))
+
+
+def u1_ring_resting():
+    seed = header(U1, ring=True, dwell=2, travel=1, thumb_zone=35)
+    for i in range(120):
+        fingers = [(1500, 1500), None if i % 30 < 10 else (2500, 2800), (3500, 1200 + 5 * i)]
+        seed += report(u1_report(fingers, i % 40 > 30), dt=4)
+        if i % 25 == 0:
+            seed += key(dt=2)
+    return seed + report(u1_report([]))
+
+
+SEEDS = [t4_tap, t4_four_finger_click, t4_click_without_contacts, t4_rotated_typing,
+         u1_two_finger_scroll, u1_resting_click, t4_ring_overflow, u1_ring_resting]
+
+if __name__ == "__main__":
+    directory = os.path.dirname(os.path.abspath(__file__))
+    for seed in SEEDS:
+        with open(os.path.join(directory, seed.__name__ + ".bin"), "wb") as f:
+            f.write(seed())